@@ -0,0 +1,30 @@
+#ifndef OBFUSCATOR_AUTOTUNER_H
+#define OBFUSCATOR_AUTOTUNER_H
+
+#include "Obfuscation/Config.h"
+#include "Obfuscation/Presets.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Error.h"
+#include <string>
+
+namespace obfuscator {
+
+struct AutotuneOptions {
+    // Shell command run against each candidate; every "{}" is replaced with
+    // the path of the obfuscated bitcode.
+    std::string BenchCommand;
+    int Trials = 24;
+    int Runs = 3;
+};
+
+// Searches pass enables and strength parameters for the configuration with
+// the highest obfuscation score whose measured overhead fits the budget of
+// Opts.Level, starting from Opts itself. Size is the machine code the module
+// lowers to. On success Opts holds the chosen configuration; it is an error
+// if no trial within the budget obfuscated anything.
+llvm::Expected<TuningResult> autotune(const llvm::Module &M, ObfuscationOptions &Opts,
+                                      const AutotuneOptions &AO);
+
+}  
+
+#endif  
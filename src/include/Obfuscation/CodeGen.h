@@ -0,0 +1,28 @@
+#ifndef OBFUSCATOR_CODEGEN_H
+#define OBFUSCATOR_CODEGEN_H
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Target/TargetMachine.h"
+#include <memory>
+#include <string>
+
+namespace obfuscator {
+
+struct ObjectEmitOptions {
+    // Number of partitions compiled in parallel; 0 uses every hardware thread.
+    unsigned Partitions = 1;
+    // Linker used to merge partitions into one relocatable object (-r).
+    std::string Linker = "ld.lld";
+};
+
+// Creates a TargetMachine for the module's triple (the host triple if the
+// module has none), filling in the data layout if it is missing.
+llvm::Expected<std::unique_ptr<llvm::TargetMachine>> createTargetMachine(llvm::Module &M);
+
+llvm::Error emitObjectFile(llvm::Module &M, llvm::StringRef Path, const ObjectEmitOptions &EO);
+
+}  
+
+#endif  
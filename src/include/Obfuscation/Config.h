@@ -15,6 +15,19 @@ enum class ObfuscationLevel {
     Insane = 5
 };
 
+enum class PipelinePlacement {
+    PipelineStart,
+    ScalarOptimizerLate,
+    VectorizerStart,
+    OptimizerLast
+};
+
+enum class VerifyMode {
+    Full,
+    Sampled,
+    Off
+};
+
 struct ObfuscationOptions {
     ObfuscationLevel Level = ObfuscationLevel::None;
 
@@ -27,12 +40,39 @@ struct ObfuscationOptions {
     int FlaSplitNum = 3;
     int BcfProb = 50;
     int BcfLoop = 1;
+    int SubProb = 50;
     uint64_t Seed = 0;
 
+    int OptLevel = 0;
+    PipelinePlacement StrPlacement = PipelinePlacement::OptimizerLast;
+    PipelinePlacement IndPlacement = PipelinePlacement::OptimizerLast;
+    PipelinePlacement SubPlacement = PipelinePlacement::OptimizerLast;
+    PipelinePlacement BcfPlacement = PipelinePlacement::OptimizerLast;
+    PipelinePlacement FlaPlacement = PipelinePlacement::OptimizerLast;
+
+    bool Instrument = false;
+    bool Outline = false;
+    // Skip bogus flow and substitutions that would push live values past
+    // the target's register budget. Needs a module with a triple and data
+    // layout for a target that is linked in; off otherwise.
+    bool RegPressure = false;
+    // Skips string encryption and indirect calls even where a policy rule
+    // turns them on (the JIT transform).
+    bool FunctionPassesOnly = false;
+
+    unsigned FnTimeLimitMs = 0;
+    double FnGrowthLimit = 0;
+
     bool GenReport = false;
     std::string ReportPath = "obfuscation_report.json";
     
     struct ObfuscationStats *Stats = nullptr;
+    class FunctionReport *FnReport = nullptr;
+    class FunctionVerifier *Verifier = nullptr;
+    class FunctionLayout *Layout = nullptr;
+    const class FunctionDeadline *Deadline = nullptr;
+    const class ObfuscationPolicy *Policy = nullptr;
+    const class FunctionPolicyHook *PolicyHook = nullptr;
 };
 
 struct ObfuscationStats {
@@ -40,9 +80,14 @@ struct ObfuscationStats {
     int BogusBlocks = 0;
     int OpaquePredicates = 0;
     int FlattenedFunctions = 0;
+    int DispatchRegions = 0;
     int EncryptedStrings = 0;
+    int StringPages = 0;
     int SubstitutedInstrs = 0;
     int IndirectCalls = 0;
+    int WatchdogFallbacks = 0;
+    int BcfPressureSkips = 0;
+    int SubPressureSkips = 0;
     
     int OrgBlocks = 0;
     int NewBlocks = 0;
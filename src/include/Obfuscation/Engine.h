@@ -0,0 +1,27 @@
+#ifndef OBFUSCATOR_ENGINE_H
+#define OBFUSCATOR_ENGINE_H
+
+#include "llvm/IR/Module.h"
+#include "llvm/IR/PassManager.h"
+#include "Obfuscation/Config.h"
+#include <optional>
+
+namespace obfuscator {
+
+class ObfuscationEngine {
+public:
+    explicit ObfuscationEngine(ObfuscationOptions Opts) : Options(Opts) {}
+
+    void run(llvm::Module &M);
+
+private:
+    // With no placement, adds every enabled pass (the -O0 pipeline).
+    void addModulePasses(llvm::ModulePassManager &MPM, std::optional<PipelinePlacement> At);
+    void addFunctionPasses(llvm::FunctionPassManager &FPM, std::optional<PipelinePlacement> At);
+
+    ObfuscationOptions Options;
+};
+
+}  
+
+#endif  
@@ -0,0 +1,23 @@
+#ifndef OBFUSCATOR_INSTRUMENTATION_H
+#define OBFUSCATOR_INSTRUMENTATION_H
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Module.h"
+
+namespace obfuscator {
+
+// Adds Amount to the calling thread's counter for (F, Kind) at the builder's
+// insertion point. Counters are internal thread-local globals; the ObfProfile
+// runtime folds them into process totals and writes them at exit.
+void emitProfileIncrement(llvm::IRBuilder<> &Builder, llvm::Function &F,
+                          llvm::StringRef Kind, uint64_t Amount = 1);
+
+// Registers the module's counters with the runtime and adds the per-thread
+// setup check to every instrumented function. Run once after all passes.
+void finalizeProfileInstrumentation(llvm::Module &M);
+
+}  
+
+#endif  
@@ -0,0 +1,96 @@
+#ifndef OBFUSCATOR_JIT_H
+#define OBFUSCATOR_JIT_H
+
+#include "Obfuscation/Config.h"
+#include "Obfuscation/Policy.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ExecutionEngine/Orc/Core.h"
+#include "llvm/ExecutionEngine/Orc/IRTransformLayer.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace obfuscator {
+
+// Obfuscates each module an ORC layer materializes. Behind a
+// CompileOnDemandLayer (LLLazyJIT) a module is one function, obfuscated
+// when it is first called. Only substitution, bogus control flow and
+// flattening run: string encryption, indirect calls and instrumentation
+// rewrite the whole module and rely on constructors that a lazily
+// materialized function never runs. Modules may be transformed
+// concurrently; the hook must be safe to call from several threads.
+class ObfuscationTransform {
+public:
+    explicit ObfuscationTransform(ObfuscationOptions Opts,
+                                  FunctionPolicyHook::Callback Hook = nullptr);
+
+    ObfuscationTransform(const ObfuscationTransform &) = delete;
+    ObfuscationTransform &operator=(const ObfuscationTransform &) = delete;
+
+    llvm::Expected<llvm::orc::ThreadSafeModule> operator()(llvm::orc::ThreadSafeModule TSM,
+                                                           llvm::orc::MaterializationResponsibility &R);
+
+    // Fails when the result does not verify, so a bad function surfaces as
+    // a materialization error instead of miscompiled code.
+    llvm::Error transform(llvm::Module &M) const;
+
+private:
+    ObfuscationOptions Options;
+    std::optional<FunctionPolicyHook> Hook;
+};
+
+// An IRTransformLayer that obfuscates every module before BaseLayer
+// compiles it. Transform must outlive the layer.
+class ObfuscationLayer : public llvm::orc::IRTransformLayer {
+public:
+    ObfuscationLayer(llvm::orc::ExecutionSession &ES, llvm::orc::IRLayer &BaseLayer,
+                     ObfuscationTransform &Transform);
+};
+
+// Installs Transform as J's IR transform, which sits below the
+// CompileOnDemandLayer in an LLLazyJIT. Transform must outlive J.
+void installObfuscation(llvm::orc::LLJIT &J, ObfuscationTransform &Transform);
+
+// Runs main of TSM in an LLLazyJIT for the host with Transform installed, so
+// every function is obfuscated and compiled on its first call, and returns
+// its result. ProgramName becomes argv[0], followed by Args. Symbols the
+// module does not define resolve against the host process.
+llvm::Expected<int> runLazily(llvm::orc::ThreadSafeModule TSM, ObfuscationTransform &Transform,
+                              llvm::ArrayRef<std::string> Args, llvm::StringRef ProgramName);
+
+struct JITLatencySample {
+    double TransformUs = 0;
+    double CompileUs = 0;
+    uint64_t ObjectBytes = 0;
+};
+
+struct JITFunctionLatency {
+    std::string Function;
+    unsigned Instrs = 0;
+    JITLatencySample Baseline;
+    JITLatencySample Obfuscated;
+    std::string Error;
+};
+
+struct JITLatencyReport {
+    std::string Triple;
+    std::vector<JITFunctionLatency> Functions;
+};
+
+// Compiles every defined function of M on its own, the way a lazy JIT does
+// on first call, once plain and once through ObfuscationTransform. Each
+// figure is the fastest of Runs attempts.
+llvm::Expected<JITLatencyReport> measureJITLatency(const llvm::Module &M, const ObfuscationOptions &Opts,
+                                                   unsigned Runs = 3);
+
+void writeJITLatencyReport(llvm::raw_ostream &OS, const JITLatencyReport &Report);
+
+}  
+
+#endif  
@@ -0,0 +1,53 @@
+#ifndef OBFUSCATOR_LAYOUT_H
+#define OBFUSCATOR_LAYOUT_H
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace obfuscator {
+
+// Places obfuscated functions by hotness. Hotness comes from the profile
+// summary when the module has one, otherwise from hot/cold attributes and
+// call sites weighted by loop depth, and is measured before obfuscation.
+class FunctionLayout {
+public:
+    explicit FunctionLayout(bool SectionHints) : SectionHints(SectionHints) {}
+
+    bool hasSectionHints() const { return SectionHints; }
+
+    void analyze(llvm::Module &M, llvm::ModuleAnalysisManager &MAM);
+
+    // Called by the obfuscation passes for each function they change.
+    void touched(const llvm::Function &F);
+
+    // Moves the changed functions into .text.hot / .text.unlikely when
+    // section hints are on. Functions added by obfuscation only run at
+    // startup and count as cold.
+    void apply(llvm::Module &M);
+
+    // Writes one symbol per line for the changed functions: hot first,
+    // cold last, hotter functions earlier.
+    void writeOrderFile(llvm::raw_ostream &OS, const llvm::Module &M) const;
+
+private:
+    enum Temperature { Hot, Normal, Cold };
+
+    struct Info {
+        Temperature Temp = Normal;
+        uint64_t Score = 0;
+        bool Touched = false;
+    };
+
+    bool isTouched(const llvm::Function &F) const;
+    Temperature getTemperature(const llvm::Function &F) const;
+    uint64_t getScore(const llvm::Function &F) const;
+
+    bool SectionHints;
+    llvm::StringMap<Info> Functions;
+};
+
+}  
+
+#endif  
@@ -0,0 +1,38 @@
+#ifndef OBFUSCATOR_MACHINEREPORT_H
+#define OBFUSCATOR_MACHINEREPORT_H
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/raw_ostream.h"
+#include <cstdint>
+#include <string>
+
+namespace obfuscator {
+
+struct MachineFunctionStats {
+    uint64_t TextBytes = 0;
+    uint64_t JumpTableBytes = 0;
+    unsigned Instrs = 0;
+    unsigned Loads = 0;
+    unsigned Stores = 0;
+    unsigned Branches = 0;
+    unsigned IndirectBranches = 0;
+};
+
+struct MachineModuleStats {
+    std::string Triple;
+    llvm::StringMap<MachineFunctionStats> Functions;
+};
+
+// Lowers a copy of M to an in-memory object for its target. Instruction and
+// jump-table figures are taken from the final machine functions, and .text
+// bytes from the emitted symbol sizes. M is left unchanged.
+llvm::Expected<MachineModuleStats> collectMachineStats(const llvm::Module &M);
+
+void writeMachineReport(llvm::raw_ostream &OS, const MachineModuleStats &Baseline,
+                        const MachineModuleStats &Obfuscated);
+
+}  
+
+#endif  
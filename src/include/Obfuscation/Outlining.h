@@ -0,0 +1,29 @@
+#ifndef OBFUSCATOR_OUTLINING_H
+#define OBFUSCATOR_OUTLINING_H
+
+#include "Obfuscation/Config.h"
+#include "Obfuscation/Utils.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Module.h"
+
+namespace obfuscator {
+
+// Size mode (-outline): opaque predicates call one of a few shared internal
+// evaluators, each site passing its own constant, instead of carrying a
+// copy of the predicate.
+
+// Creates the helpers before the pipeline runs, so no pass has to add
+// functions in the middle of a CGSCC walk. They are held in
+// llvm.compiler.used until finalizeOutlinedHelpers.
+void createOutlinedHelpers(llvm::Module &M, const ObfuscationOptions &Options);
+
+// Returns nullptr when there is no helper; the caller then expands the
+// predicate inline.
+llvm::Value *emitOutlinedOpaquePredicate(llvm::IRBuilder<> &Builder, llvm::Module &M, RandomStream &RNG);
+
+// Releases the helpers from llvm.compiler.used and deletes those never called.
+void finalizeOutlinedHelpers(llvm::Module &M);
+
+}  
+
+#endif  
@@ -3,13 +3,40 @@
 
 #include "llvm/IR/PassManager.h"
 #include "Obfuscation/Config.h"
+#include "Obfuscation/Verification.h"
+#include <chrono>
 
 namespace obfuscator {
 
+// The watchdog's time budget, handed to the function passes through
+// ObfuscationOptions::Deadline. The passes poll it between blocks and stop
+// early, leaving valid IR for the watchdog to throw away.
+class FunctionDeadline {
+public:
+    explicit FunctionDeadline(unsigned LimitMs) : Limit(LimitMs) { restart(); }
+    void restart() { Start = std::chrono::steady_clock::now(); }
+    bool expired() const { return Limit.count() && std::chrono::steady_clock::now() - Start > Limit; }
+
+private:
+    std::chrono::milliseconds Limit;
+    std::chrono::steady_clock::time_point Start;
+};
+
+inline bool pastDeadline(const ObfuscationOptions &Options) {
+    return Options.Deadline && Options.Deadline->expired();
+}
+
+// The passes are required, so the verifier cannot skip them after a failed
+// check; they leave the module alone themselves until the failure is
+// reported.
+inline bool verificationFailed(const ObfuscationOptions &Options) {
+    return Options.Verifier && Options.Verifier->failed();
+}
+
 class SubstitutionPass : public llvm::PassInfoMixin<SubstitutionPass> {
 public:
     explicit SubstitutionPass(ObfuscationOptions Options) : Options(Options) {}
-    llvm::PreservedAnalyses run(llvm::Module &M, llvm::ModuleAnalysisManager &AM);
+    llvm::PreservedAnalyses run(llvm::Function &F, llvm::FunctionAnalysisManager &AM);
     static bool isRequired() { return true; }
 private:
     ObfuscationOptions Options;
@@ -36,7 +63,7 @@ private:
 class FlatteningPass : public llvm::PassInfoMixin<FlatteningPass> {
 public:
     explicit FlatteningPass(ObfuscationOptions Options) : Options(Options) {}
-    llvm::PreservedAnalyses run(llvm::Module &M, llvm::ModuleAnalysisManager &AM);
+    llvm::PreservedAnalyses run(llvm::Function &F, llvm::FunctionAnalysisManager &AM);
     static bool isRequired() { return true; }
 private:
     ObfuscationOptions Options;
@@ -45,10 +72,25 @@ private:
 class BogusControlFlowPass : public llvm::PassInfoMixin<BogusControlFlowPass> {
 public:
     explicit BogusControlFlowPass(ObfuscationOptions Options) : Options(Options) {}
-    llvm::PreservedAnalyses run(llvm::Module &M, llvm::ModuleAnalysisManager &AM);
+    llvm::PreservedAnalyses run(llvm::Function &F, llvm::FunctionAnalysisManager &AM);
+    static bool isRequired() { return true; }
+private:
+    ObfuscationOptions Options;
+};
+
+// Runs the enabled function passes under the per-function time and growth
+// limits. The passes stop as soon as the time limit passes; a function over
+// a limit is restored and retried with substitution only, then left
+// unobfuscated.
+class FunctionWatchdogPass : public llvm::PassInfoMixin<FunctionWatchdogPass> {
+public:
+    FunctionWatchdogPass(ObfuscationOptions Options, bool Sub, bool Bcf, bool Fla)
+        : Options(Options), Sub(Sub), Bcf(Bcf), Fla(Fla) {}
+    llvm::PreservedAnalyses run(llvm::Function &F, llvm::FunctionAnalysisManager &AM);
     static bool isRequired() { return true; }
 private:
     ObfuscationOptions Options;
+    bool Sub, Bcf, Fla;
 };
 
 }  
@@ -0,0 +1,137 @@
+#ifndef OBFUSCATOR_POLICY_H
+#define OBFUSCATOR_POLICY_H
+
+#include "Obfuscation/Config.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/JSON.h"
+#include <bitset>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace obfuscator {
+
+// Globs and regexes compiled together into one automaton. DFA states are
+// built on first use and cached, so matching a name costs one table lookup
+// per byte however many patterns there are. The cache is shared, so match()
+// holds a mutex for the whole name: callers on different threads (-variants
+// workers, server requests sharing the default policy) take turns. That costs
+// little next to the passes that ask, but a hot multi-threaded caller should
+// keep its own automaton.
+class PatternAutomaton {
+public:
+    llvm::Error addGlob(llvm::StringRef Pattern, unsigned Id);
+    llvm::Error addRegex(llvm::StringRef Pattern, unsigned Id);
+    llvm::Error compile();
+
+    // Appends the ids of every pattern matching the whole of Name, in
+    // ascending order.
+    void match(llvm::StringRef Name, llvm::SmallVectorImpl<unsigned> &Ids) const;
+
+    struct Node {
+        std::bitset<256> Bytes;
+        int Out = -1;
+        int Out1 = -1;
+        int Accept = -1;
+        bool Epsilon = true;
+    };
+
+private:
+    llvm::Error add(llvm::StringRef Pattern, unsigned Id, bool Regex);
+    std::vector<int> closure(std::vector<int> &Stack) const;
+    uint32_t intern(std::vector<int> Set) const;
+    uint32_t resetCache(std::vector<int> Keep = {}) const;
+    uint32_t step(uint32_t S, unsigned Class) const;
+
+    std::vector<Node> Nodes;
+    std::vector<int> Starts;
+    unsigned NumClasses = 1;
+    uint8_t ClassOf[256] = {};
+    std::vector<uint8_t> ClassRep;
+
+    mutable std::mutex Lock;
+    mutable std::vector<unsigned> Mark;
+    mutable unsigned Gen = 0;
+    mutable std::map<std::vector<int>, uint32_t> Index;
+    mutable std::vector<const std::vector<int> *> States;
+    mutable std::vector<std::vector<unsigned>> Accepts;
+    mutable std::vector<int32_t> Next;
+    mutable uint32_t Start = 0;
+};
+
+struct PolicyRule {
+    std::string Name;
+    bool HasModule = false;
+
+    std::optional<bool> Str, Sub, Ind, Bcf, Fla;
+    std::optional<int> FlaSplitNum, BcfProb, BcfLoop, SubProb;
+};
+
+// Passes and strengths that apply to one function or global.
+struct PassPolicy {
+    explicit PassPolicy(const ObfuscationOptions &Opts);
+    void apply(const PolicyRule &R);
+
+    bool EnableStr, EnableSub, EnableInd, EnableBcf, EnableFla;
+    int FlaSplitNum, BcfProb, BcfLoop, SubProb;
+    llvm::StringRef Reason;
+};
+
+// Called for every function after the policy rules, to choose its strengths
+// at run time. It can turn passes off; a pass it turns on only runs if the
+// options already enable it somewhere.
+class FunctionPolicyHook {
+public:
+    using Callback = std::function<void(const llvm::Function &, PassPolicy &)>;
+
+    explicit FunctionPolicyHook(Callback Fn) : Fn(std::move(Fn)) {}
+    void operator()(const llvm::Function &F, PassPolicy &P) const { Fn(F, P); }
+
+private:
+    Callback Fn;
+};
+
+// Rules from a JSON or YAML policy file; the first matching rule wins. Rules 0
+// and 1 are built in and keep the passes that cannot handle them away from the
+// obfuscator's own decrypt_ and outlined_ helpers.
+class ObfuscationPolicy {
+public:
+    static llvm::Expected<std::unique_ptr<ObfuscationPolicy>> load(llvm::StringRef Path);
+    static llvm::Expected<std::unique_ptr<ObfuscationPolicy>> parse(llvm::StringRef Buffer, bool Yaml);
+    static const ObfuscationPolicy &getDefault();
+
+    const PolicyRule *lookup(const llvm::Function &F) const;
+    const PolicyRule *lookup(const llvm::GlobalVariable &GV) const;
+    llvm::ArrayRef<PolicyRule> rules() const { return Rules; }
+
+private:
+    ObfuscationPolicy();
+    llvm::Error addRule(const llvm::json::Object &O, unsigned Index);
+    llvm::Error compile();
+    const PolicyRule *lookup(const PatternAutomaton &Names, llvm::StringRef Name,
+                             const llvm::Module &M) const;
+
+    std::vector<PolicyRule> Rules;
+    PatternAutomaton Functions;
+    PatternAutomaton Globals;
+    PatternAutomaton Modules;
+};
+
+PassPolicy getFunctionPolicy(const ObfuscationOptions &Opts, const llvm::Function &F);
+PassPolicy getGlobalPolicy(const ObfuscationOptions &Opts, const llvm::GlobalVariable &GV);
+
+// Passes that may run on some function or global, used to build the pipeline.
+PassPolicy getPipelinePolicy(const ObfuscationOptions &Opts);
+
+}  
+
+#endif  
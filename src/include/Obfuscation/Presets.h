@@ -0,0 +1,40 @@
+#ifndef OBFUSCATOR_PRESETS_H
+#define OBFUSCATOR_PRESETS_H
+
+#include "Obfuscation/Config.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace obfuscator {
+
+// Overhead tier a level is allowed to cost, as ratios against the
+// unobfuscated build: run time of the benchmark, and bytes of machine code
+// (.text and jump tables). A limit of 0 means unbounded.
+struct OverheadBudget {
+    double MaxRuntime = 0;
+    double MaxSize = 0;
+};
+
+struct TuningResult {
+    double RuntimeOverhead = 1.0;
+    double SizeOverhead = 1.0;
+    double Score = 0;
+};
+
+const char *getLevelName(ObfuscationLevel Level);
+const char *getPlacementName(PipelinePlacement P);
+bool parsePlacementName(llvm::StringRef Name, PipelinePlacement &P);
+OverheadBudget getOverheadBudget(ObfuscationLevel Level);
+
+void applyLevel(ObfuscationOptions &Opts, ObfuscationLevel Level);
+
+llvm::Error loadPreset(llvm::StringRef Path, ObfuscationOptions &Opts);
+llvm::Error parsePreset(llvm::StringRef Buffer, ObfuscationOptions &Opts);
+void writeOptions(llvm::raw_ostream &OS, const ObfuscationOptions &Opts);
+void writePreset(llvm::raw_ostream &OS, const ObfuscationOptions &Opts,
+                 const TuningResult &Result);
+
+}  
+
+#endif  
@@ -0,0 +1,54 @@
+#ifndef OBFUSCATOR_REGISTERPRESSURE_H
+#define OBFUSCATOR_REGISTERPRESSURE_H
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+
+namespace obfuscator {
+
+// Whether TargetIRAnalysis can describe M's target. Without a triple and a
+// data layout it answers with generic register counts, which say nothing
+// about the registers the code will get.
+inline bool hasTargetInfo(const llvm::Module &M) {
+    return !M.getTargetTriple().empty() && !M.getDataLayoutStr().empty();
+}
+
+// Live SSA values per target register class, from a liveness pass over the
+// IR. Constants and static allocas are not counted. This is an estimate made
+// before instruction selection: it knows nothing of spills, copies or values
+// the backend folds away, but it finds the blocks where adding live values
+// would go past the registers the target has.
+class RegisterPressure {
+public:
+    RegisterPressure(llvm::Function &F, const llvm::TargetTransformInfo &TTI);
+
+    // Whether Extra more values of Ty's class, live at the top of BB (after
+    // its PHIs), would exceed the budget.
+    bool exceedsAtEntry(const llvm::BasicBlock &BB, llvm::Type *Ty, unsigned Extra) const;
+
+    // Whether Extra more values of I's class, live just before I alongside
+    // its operands, would exceed the budget.
+    bool exceedsAt(const llvm::Instruction &I, unsigned Extra) const;
+
+    // Records N values of Ty's class added to BB after the analysis ran.
+    // They count against every later query in BB, as the scheduler may
+    // keep them live across the rest of the block.
+    void addLive(const llvm::BasicBlock &BB, llvm::Type *Ty, unsigned N);
+
+private:
+    unsigned getClass(llvm::Type *Ty) const;
+    bool exceeds(unsigned Class, unsigned Live, unsigned Extra) const;
+
+    const llvm::TargetTransformInfo &TTI;
+    mutable llvm::DenseMap<llvm::Type *, unsigned> Classes;
+    llvm::DenseMap<const llvm::BasicBlock *, llvm::SmallVector<unsigned, 2>> EntryLive;
+    llvm::DenseMap<const llvm::Instruction *, unsigned> LiveBefore;
+    llvm::DenseMap<const llvm::BasicBlock *, llvm::SmallVector<unsigned, 2>> Added;
+};
+
+}  
+
+#endif  
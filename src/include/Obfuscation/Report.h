@@ -0,0 +1,84 @@
+#ifndef OBFUSCATOR_REPORT_H
+#define OBFUSCATOR_REPORT_H
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Support/raw_ostream.h"
+#include "Obfuscation/Config.h"
+#include <chrono>
+#include <utility>
+
+namespace obfuscator {
+
+// Seed is the effective one, so a run without -seed can be reproduced.
+void writeStatsReport(llvm::raw_ostream &OS, const ObfuscationStats &Stats, uint64_t Seed);
+
+// Streams one JSON object per function (JSON Lines) as soon as the function
+// pipeline finishes with it. Only the record of the function currently being
+// processed is kept, so memory use does not grow with the module.
+class FunctionReport {
+public:
+    explicit FunctionReport(llvm::raw_ostream &OS) : OS(OS) {}
+
+    void begin(const llvm::Function &F);
+    void applied(llvm::StringRef Pass);
+    void skipped(llvm::StringRef Pass, llvm::StringRef Reason);
+    void fallback(llvm::StringRef Tier, llvm::StringRef Reason);
+    void end(const llvm::Function &F);
+
+private:
+    llvm::raw_ostream &OS;
+
+    llvm::SmallVector<llvm::StringRef, 4> Applied;
+    llvm::SmallVector<std::pair<llvm::StringRef, llvm::StringRef>, 4> Skipped;
+    llvm::StringRef FallbackTier;
+    llvm::StringRef FallbackReason;
+    unsigned OrgBlocks = 0;
+    unsigned OrgInstrs = 0;
+    std::chrono::steady_clock::time_point Start;
+};
+
+// Wall time of the tool's top-level phases. Each call to end() closes the
+// phase that began where the previous one ended.
+class PhaseTimer {
+public:
+    explicit PhaseTimer(std::chrono::steady_clock::time_point Start) : Start(Start), Last(Start) {}
+
+    void end(llvm::StringRef Phase);
+    void print(llvm::raw_ostream &OS) const;
+
+private:
+    std::chrono::steady_clock::time_point Start;
+    std::chrono::steady_clock::time_point Last;
+    llvm::SmallVector<std::pair<llvm::StringRef, std::chrono::steady_clock::duration>, 6> Phases;
+};
+
+class FunctionReportBeginPass : public llvm::PassInfoMixin<FunctionReportBeginPass> {
+public:
+    explicit FunctionReportBeginPass(FunctionReport &Report) : Report(Report) {}
+    llvm::PreservedAnalyses run(llvm::Function &F, llvm::FunctionAnalysisManager &AM) {
+        Report.begin(F);
+        return llvm::PreservedAnalyses::all();
+    }
+    static bool isRequired() { return true; }
+private:
+    FunctionReport &Report;
+};
+
+class FunctionReportEndPass : public llvm::PassInfoMixin<FunctionReportEndPass> {
+public:
+    explicit FunctionReportEndPass(FunctionReport &Report) : Report(Report) {}
+    llvm::PreservedAnalyses run(llvm::Function &F, llvm::FunctionAnalysisManager &AM) {
+        Report.end(F);
+        return llvm::PreservedAnalyses::all();
+    }
+    static bool isRequired() { return true; }
+private:
+    FunctionReport &Report;
+};
+
+}
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef OBFUSCATOR_SERVER_H
+#define OBFUSCATOR_SERVER_H
+
+#include "Obfuscation/Config.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Error.h"
+#include <cstdint>
+#include <string>
+
+namespace obfuscator {
+
+// Wire format, all integers little-endian:
+//   request:  "OBF1" | u64 seed | u32 len | options JSON | u64 len | IR (text or bitcode)
+//   response: u32 status | u32 len | report JSON or error | u64 len | bitcode
+struct ServerOptions {
+    std::string SocketPath;
+    unsigned Threads = 0;
+    // A client that sends nothing for this long is dropped, so a stalled
+    // connection cannot hold a pool thread. 0 waits forever.
+    unsigned ReadTimeoutSec = 30;
+    // Largest IR a request may carry; bigger requests are refused before
+    // anything is allocated.
+    uint64_t MaxInputBytes = uint64_t(256) << 20;
+};
+
+struct RemoteResult {
+    std::string Bitcode;
+    std::string Report;
+};
+
+// Serves obfuscation requests on a Unix domain socket until the process is
+// killed. Each request is handled on a pool thread with its own LLVMContext.
+llvm::Error runServer(const ServerOptions &SO);
+
+llvm::Expected<RemoteResult> obfuscateRemote(llvm::StringRef SocketPath, llvm::StringRef Input,
+                                             const ObfuscationOptions &Opts);
+
+}  
+
+#endif  
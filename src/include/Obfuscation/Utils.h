@@ -5,31 +5,68 @@
 #include "llvm/IR/Function.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/Support/xxhash.h"
+#include <cstdint>
 #include <random>
 
 namespace obfuscator {
 
 class Utils {
 public:
-    static void seedRandom(uint64_t seed) {
-        if (seed == 0) srand(time(NULL));
-        else srand((unsigned int)seed);
+    // Independent seed for stream Stream of a base seed (splitmix64).
+    static uint64_t deriveSeed(uint64_t Seed, uint64_t Stream) {
+        uint64_t Z = Seed + (Stream + 1) * 0x9E3779B97F4A7C15ULL;
+        Z = (Z ^ (Z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        Z = (Z ^ (Z >> 27)) * 0x94D049BB133111EBULL;
+        return Z ^ (Z >> 31);
     }
 
-    static bool roll(int percentage) {
-        return (rand() % 100) < percentage;
+    // Fresh nonzero seed for runs without -seed.
+    static uint64_t randomSeed() {
+        std::random_device RD;
+        uint64_t Seed = 0;
+        while (!Seed) Seed = (static_cast<uint64_t>(RD()) << 32) | RD();
+        return Seed;
     }
 
-    static int randomRange(int min, int max) {
-        return min + (rand() % (max - min + 1));
+    static void fixStack(llvm::Function *f) {
+    }
+};
+
+// Counter-based random stream: draw N is a pure function of the stream key
+// and N. Keys come from (seed, pass, symbol name, site), so decisions do not
+// depend on the order functions are visited or on the number of threads.
+class RandomStream {
+public:
+    RandomStream(uint64_t Seed, llvm::StringRef Pass, llvm::StringRef Name, uint64_t Site = 0)
+        : Key(Utils::deriveSeed(Utils::deriveSeed(Utils::deriveSeed(Seed, llvm::xxHash64(Pass)),
+                                                  llvm::xxHash64(Name)), Site)) {}
+
+    uint64_t next() { return Utils::deriveSeed(Key, Counter++); }
+
+    // Uniform in [0, Bound) without modulo bias.
+    uint64_t below(uint64_t Bound) {
+        uint64_t Limit = UINT64_MAX - UINT64_MAX % Bound;
+        uint64_t X;
+        do X = next(); while (X >= Limit);
+        return X % Bound;
     }
-    
-    static uint8_t randomByte() {
-        return (uint8_t)(rand() % 256);
+
+    bool roll(int Percentage) {
+        return static_cast<int>(below(100)) < Percentage;
     }
 
-    static void fixStack(llvm::Function *f) {
+    int range(int Min, int Max) {
+        return Min + static_cast<int>(below(static_cast<uint64_t>(Max - Min) + 1));
     }
+
+    uint8_t byte() {
+        return static_cast<uint8_t>(next() >> 56);
+    }
+
+private:
+    uint64_t Key;
+    uint64_t Counter = 0;
 };
 
 }  
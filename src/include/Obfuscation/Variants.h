@@ -0,0 +1,48 @@
+#ifndef OBFUSCATOR_VARIANTS_H
+#define OBFUSCATOR_VARIANTS_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/raw_ostream.h"
+#include "Obfuscation/CodeGen.h"
+#include "Obfuscation/Config.h"
+#include <string>
+#include <vector>
+
+namespace obfuscator {
+
+struct VariantOptions {
+    unsigned Count = 1;
+    // Worker threads; 0 uses every hardware thread.
+    unsigned Threads = 0;
+    // Output path; "{}" is replaced with the variant index, otherwise the
+    // index is inserted before the extension (out.bc -> out.3.bc).
+    std::string OutputPattern = "out.bc";
+    bool EmitObject = false;
+    ObjectEmitOptions ObjectOptions;
+    VerifyMode Verify = VerifyMode::Full;
+    unsigned VerifySample = 8;
+    bool VerifyModule = false;
+};
+
+struct VariantResult {
+    unsigned Index = 0;
+    uint64_t Seed = 0;
+    std::string Path;
+    ObfuscationStats Stats;
+    std::string Error;
+};
+
+std::string getVariantPath(llvm::StringRef Pattern, unsigned Index);
+
+// Obfuscates VO.Count copies of M with seeds derived from Opts.Seed. Each
+// worker parses M once into its own context and clones it per variant.
+std::vector<VariantResult> buildVariants(const llvm::Module &M, const ObfuscationOptions &Opts,
+                                         const VariantOptions &VO);
+
+void writeVariantsReport(llvm::raw_ostream &OS, llvm::ArrayRef<VariantResult> Results);
+
+}  
+
+#endif  
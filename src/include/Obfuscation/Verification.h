@@ -0,0 +1,55 @@
+#ifndef OBFUSCATOR_VERIFICATION_H
+#define OBFUSCATOR_VERIFICATION_H
+
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/PassInstrumentation.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/ThreadPool.h"
+#include "Obfuscation/Config.h"
+#include <string>
+#include <vector>
+
+namespace obfuscator {
+
+// Verifies the functions obfuscation passes change. A changed function is
+// queued with the passes that changed it; the queue is checked on a thread
+// pool at barriers where no pass is running (before each module or CGSCC
+// pass, since the Module and LLVMContext are not thread-safe). After a
+// failure the remaining optional passes are skipped and the failure waits
+// for finish().
+class FunctionVerifier {
+public:
+    // FullModule runs verifyModule at the end instead of the module-level
+    // checks alone, re-verifying every function on one thread.
+    FunctionVerifier(VerifyMode Mode, unsigned SampleRate, unsigned Threads, bool FullModule = false);
+
+    void registerCallbacks(llvm::PassInstrumentationCallbacks &PIC);
+
+    void check(const llvm::Function &F, llvm::StringRef Pass);
+    void checkModule(const llvm::Module &M, llvm::StringRef Pass);
+
+    // Checks what is still queued, then the module-level invariants no
+    // per-function check covers (globals, llvm.global_ctors,
+    // llvm.compiler.used). Returns every failure, naming the function and
+    // the passes that changed it.
+    llvm::Error finish(const llvm::Module &M);
+
+    bool failed() const { return !Failures.empty(); }
+
+private:
+    void flush();
+
+    VerifyMode Mode;
+    unsigned SampleRate;
+    bool FullModule;
+    llvm::ThreadPool Pool;
+    llvm::MapVector<const llvm::Function*, std::vector<std::string>> Queue;
+    std::vector<std::string> Failures;
+};
+
+}  
+
+#endif  
@@ -0,0 +1,164 @@
+#include "Obfuscation/Autotuner.h"
+#include "Obfuscation/Engine.h"
+#include "Obfuscation/MachineReport.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include <chrono>
+#include <cstdlib>
+#include <limits>
+#include <random>
+
+using namespace llvm;
+
+namespace obfuscator {
+
+static double obfuscationScore(const ObfuscationStats &S) {
+    return S.FlattenedFunctions * 8.0 + S.BogusBlocks * 3.0 + S.OpaquePredicates +
+           S.SubstitutedInstrs + S.IndirectCalls * 2.0 + S.EncryptedStrings * 2.0;
+}
+
+static bool withinBudget(const OverheadBudget &B, const TuningResult &R) {
+    if (B.MaxRuntime > 0 && R.RuntimeOverhead > B.MaxRuntime) return false;
+    if (B.MaxSize > 0 && R.SizeOverhead > B.MaxSize) return false;
+    return true;
+}
+
+static Expected<double> timeBenchmark(const Module &M, const AutotuneOptions &AO) {
+    int FD;
+    SmallString<128> Path;
+    if (std::error_code EC = sys::fs::createTemporaryFile("obf-tune", "bc", FD, Path))
+        return errorCodeToError(EC);
+    {
+        raw_fd_ostream OS(FD, true);
+        WriteBitcodeToFile(M, OS);
+    }
+
+    std::string Cmd = AO.BenchCommand;
+    for (size_t Pos = Cmd.find("{}"); Pos != std::string::npos; Pos = Cmd.find("{}", Pos + Path.size()))
+        Cmd.replace(Pos, 2, Path.str().str());
+
+    double Best = std::numeric_limits<double>::max();
+    for (int i = 0; i < AO.Runs; ++i) {
+        auto Start = std::chrono::steady_clock::now();
+        int Ret = std::system(Cmd.c_str());
+        std::chrono::duration<double> Elapsed = std::chrono::steady_clock::now() - Start;
+        if (Ret != 0) {
+            sys::fs::remove(Path);
+            return createStringError(inconvertibleErrorCode(), "benchmark command failed: %s", Cmd.c_str());
+        }
+        Best = std::min(Best, Elapsed.count());
+    }
+    sys::fs::remove(Path);
+    return Best;
+}
+
+// Bytes of machine code the module lowers to: .text plus jump tables.
+static Expected<uint64_t> codeBytes(const Module &M) {
+    Expected<MachineModuleStats> Stats = collectMachineStats(M);
+    if (!Stats) return Stats.takeError();
+    uint64_t Bytes = 0;
+    for (const auto &F : Stats->Functions) Bytes += F.getValue().TextBytes + F.getValue().JumpTableBytes;
+    return Bytes;
+}
+
+static ObfuscationOptions sampleCandidate(const ObfuscationOptions &Base, std::mt19937_64 &Rng) {
+    auto pick = [&](int Lo, int Hi) {
+        return std::uniform_int_distribution<int>(Lo, Hi)(Rng);
+    };
+    ObfuscationOptions C = Base;
+    C.EnableStr = pick(0, 1);
+    C.EnableSub = pick(0, 1);
+    C.EnableInd = pick(0, 1);
+    C.EnableBcf = pick(0, 1);
+    C.EnableFla = pick(0, 1);
+    C.FlaSplitNum = pick(1, 8);
+    C.BcfProb = pick(1, 10) * 10;
+    C.BcfLoop = pick(1, 3);
+    C.SubProb = pick(1, 10) * 10;
+    return C;
+}
+
+struct Measurement {
+    double Time = 0;
+    uint64_t CodeBytes = 0;
+    ObfuscationStats Stats;
+};
+
+static Expected<Measurement> measure(const Module &M, ObfuscationOptions Opts, const AutotuneOptions &AO) {
+    std::unique_ptr<Module> Clone = CloneModule(M);
+    Measurement Result;
+    Opts.Stats = &Result.Stats;
+    Opts.FnReport = nullptr;
+    ObfuscationEngine(Opts).run(*Clone);
+
+    Expected<double> Time = timeBenchmark(*Clone, AO);
+    if (!Time) return Time.takeError();
+    Expected<uint64_t> Bytes = codeBytes(*Clone);
+    if (!Bytes) return Bytes.takeError();
+    Result.Time = *Time;
+    Result.CodeBytes = *Bytes;
+    return std::move(Result);
+}
+
+static Expected<TuningResult> evaluate(const Module &M, const ObfuscationOptions &Opts,
+                                       const AutotuneOptions &AO, const Measurement &Base) {
+    Expected<Measurement> Run = measure(M, Opts, AO);
+    if (!Run) return Run.takeError();
+
+    TuningResult R;
+    R.RuntimeOverhead = Base.Time > 0 ? Run->Time / Base.Time : 1.0;
+    R.SizeOverhead = Base.CodeBytes > 0 ? double(Run->CodeBytes) / Base.CodeBytes : 1.0;
+    R.Score = obfuscationScore(Run->Stats);
+    return R;
+}
+
+Expected<TuningResult> autotune(const Module &M, ObfuscationOptions &Opts,
+                                const AutotuneOptions &AO) {
+    OverheadBudget Budget = getOverheadBudget(Opts.Level);
+
+    // The baseline goes through the same pipeline with every pass off, so
+    // -O<N> does not count as overhead.
+    ObfuscationOptions BaseOpts = Opts;
+    BaseOpts.EnableStr = BaseOpts.EnableSub = BaseOpts.EnableInd = BaseOpts.EnableBcf = BaseOpts.EnableFla = false;
+    BaseOpts.Policy = nullptr;
+    BaseOpts.Instrument = BaseOpts.Outline = false;
+    Expected<Measurement> Base = measure(M, BaseOpts, AO);
+    if (!Base) return Base.takeError();
+
+    ObfuscationOptions Best = Opts;
+    TuningResult BestResult;
+
+    // Trial 0 is the configuration as given: level, preset and flags.
+    std::mt19937_64 Rng(Opts.Seed);
+    ObfuscationOptions Candidate = Opts;
+
+    for (int Trial = 0; Trial < AO.Trials; ++Trial) {
+        if (Trial > 0) Candidate = sampleCandidate(Opts, Rng);
+
+        Expected<TuningResult> R = evaluate(M, Candidate, AO, *Base);
+        if (!R) return R.takeError();
+
+        errs() << "autotune: trial " << Trial << " runtime x" << format("%.2f", R->RuntimeOverhead)
+               << " code size x" << format("%.2f", R->SizeOverhead) << " score " << format("%.1f", R->Score)
+               << (withinBudget(Budget, *R) ? "" : " (over budget)") << "\n";
+
+        if (withinBudget(Budget, *R) && R->Score > BestResult.Score) {
+            Best = Candidate;
+            BestResult = *R;
+        }
+    }
+
+    if (BestResult.Score <= 0) {
+        return createStringError(inconvertibleErrorCode(),
+                                 "none of %d trials obfuscated anything within the %s budget "
+                                 "(runtime x%.2f, code size x%.2f)",
+                                 AO.Trials, getLevelName(Opts.Level), Budget.MaxRuntime, Budget.MaxSize);
+    }
+    Opts = Best;
+    return BestResult;
+}
+
+}  
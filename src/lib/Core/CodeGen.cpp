@@ -0,0 +1,173 @@
+#include "Obfuscation/CodeGen.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/CodeGen/ParallelCG.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/FileUtilities.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Target/TargetOptions.h"
+#include "llvm/TargetParser/Host.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+#include <mutex>
+#include <optional>
+#include <vector>
+
+using namespace llvm;
+
+namespace obfuscator {
+
+static void initializeTargets() {
+    static std::once_flag Once;
+    std::call_once(Once, [] {
+        InitializeAllTargetInfos();
+        InitializeAllTargets();
+        InitializeAllTargetMCs();
+        InitializeAllAsmPrinters();
+    });
+}
+
+// Said once per process: the autotuner and -report-mc lower many copies of
+// the same module.
+static void warnOnce(std::once_flag &Once, const Twine &Msg) {
+    std::call_once(Once, [&] { errs() << "warning: " << Msg << "\n"; });
+}
+
+static const Target *lookupTarget(Module &M, std::string &TripleStr, std::string &Err) {
+    static std::once_flag NoTriple;
+    initializeTargets();
+    TripleStr = M.getTargetTriple();
+    if (TripleStr.empty()) {
+        TripleStr = sys::getDefaultTargetTriple();
+        warnOnce(NoTriple, M.getModuleIdentifier() + ": no target triple, compiling for the host (" + TripleStr + ")");
+        M.setTargetTriple(TripleStr);
+    }
+    return TargetRegistry::lookupTarget(TripleStr, Err);
+}
+
+static void setMissingDataLayout(Module &M, const TargetMachine &TM) {
+    static std::once_flag NoDataLayout;
+    if (!M.getDataLayoutStr().empty()) return;
+    warnOnce(NoDataLayout, M.getModuleIdentifier() + ": no data layout, using the default for " +
+                               TM.getTargetTriple().str());
+    M.setDataLayout(TM.createDataLayout());
+}
+
+// Gives every local a name unique to this module and makes it a hidden
+// global, so SplitModule can put its users in different partitions and
+// they still link once merged. Obfuscated modules share locals between
+// nearly every function (opaque_x globals, obf_strings, the outlined
+// helpers), and keeping them local would put all of those in one partition.
+static void externalizeLocals(Module &M) {
+    std::string Suffix = getUniqueModuleId(&M);
+    if (Suffix.empty()) Suffix = "." + utohexstr(MD5Hash(M.getModuleIdentifier()));
+    for (GlobalValue &GV : M.global_values()) {
+        if (!GV.hasLocalLinkage() || GV.isDeclaration()) continue;
+        GV.setName((GV.hasName() ? GV.getName() : "obf.local") + Suffix);
+        GV.setLinkage(GlobalValue::ExternalLinkage);
+        GV.setVisibility(GlobalValue::HiddenVisibility);
+    }
+}
+
+Expected<std::unique_ptr<TargetMachine>> createTargetMachine(Module &M) {
+    std::string TripleStr, Err;
+    const Target *T = lookupTarget(M, TripleStr, Err);
+    if (!T) return createStringError(inconvertibleErrorCode(), Err);
+
+    std::unique_ptr<TargetMachine> TM(
+        T->createTargetMachine(TripleStr, "", "", TargetOptions(), Reloc::PIC_));
+    setMissingDataLayout(M, *TM);
+    return std::move(TM);
+}
+
+Error emitObjectFile(Module &M, StringRef Path, const ObjectEmitOptions &EO) {
+    std::string TripleStr, Err;
+    const Target *T = lookupTarget(M, TripleStr, Err);
+    if (!T) return createStringError(inconvertibleErrorCode(), Err);
+
+    auto TMFactory = [&]() {
+        return std::unique_ptr<TargetMachine>(
+            T->createTargetMachine(TripleStr, "", "", TargetOptions(), Reloc::PIC_));
+    };
+    setMissingDataLayout(M, *TMFactory());
+
+    unsigned Partitions = EO.Partitions ? EO.Partitions : hardware_concurrency().compute_thread_count();
+
+    if (Partitions <= 1) {
+        std::error_code EC;
+        ToolOutputFile Out(Path, EC, sys::fs::OF_None);
+        if (EC) return errorCodeToError(EC);
+        splitCodeGen(M, {&Out.os()}, {}, TMFactory, CodeGenFileType::ObjectFile, /*PreserveLocals=*/true);
+        Out.keep();
+        return Error::success();
+    }
+
+    std::vector<std::unique_ptr<ToolOutputFile>> Parts;
+    std::vector<raw_pwrite_stream*> OSs;
+    for (unsigned i = 0; i < Partitions; ++i) {
+        int FD;
+        SmallString<128> PartPath;
+        if (std::error_code EC = sys::fs::createTemporaryFile("obf-part", "o", FD, PartPath))
+            return errorCodeToError(EC);
+        Parts.push_back(std::make_unique<ToolOutputFile>(PartPath, FD));
+        OSs.push_back(&Parts.back()->os());
+    }
+
+    externalizeLocals(M);
+    splitCodeGen(M, OSs, {}, TMFactory, CodeGenFileType::ObjectFile, /*PreserveLocals=*/false);
+
+    SmallString<128> MergedPath(Path);
+    FileRemover MergedRemover;
+    if (Path == "-") {
+        if (std::error_code EC = sys::fs::createTemporaryFile("obf-merged", "o", MergedPath))
+            return errorCodeToError(EC);
+        MergedRemover.setFile(MergedPath);
+    }
+
+    ErrorOr<std::string> Linker = sys::findProgramByName(EO.Linker);
+    if (!Linker) {
+        return createStringError(Linker.getError(), "cannot find linker '%s' to merge partitions",
+                                 EO.Linker.c_str());
+    }
+    std::vector<StringRef> Args = {*Linker, "-r", "-o", MergedPath};
+    for (auto &Part : Parts) {
+        Part->os().close();
+        Args.push_back(Part->getFilename());
+    }
+
+    SmallString<128> LogPath;
+    if (std::error_code EC = sys::fs::createTemporaryFile("obf-ld", "log", LogPath)) return errorCodeToError(EC);
+    FileRemover LogRemover(LogPath);
+    std::optional<StringRef> Redirects[] = {std::nullopt, std::nullopt, StringRef(LogPath)};
+    std::string ErrMsg;
+    int Ret = sys::ExecuteAndWait(*Linker, Args, std::nullopt, Redirects, 0, 0, &ErrMsg);
+    if (Ret != 0) {
+        std::string Log;
+        if (ErrorOr<std::unique_ptr<MemoryBuffer>> Buf = MemoryBuffer::getFile(LogPath)) {
+            Log = (*Buf)->getBuffer().trim().str();
+        }
+        if (Ret < 0) {
+            return createStringError(inconvertibleErrorCode(), "failed to run %s -r: %s", Linker->c_str(),
+                                     ErrMsg.c_str());
+        }
+        return createStringError(inconvertibleErrorCode(), "%s -r exited with status %d while merging %u partitions%s%s",
+                                 Linker->c_str(), Ret, Partitions, Log.empty() ? "" : ":\n", Log.c_str());
+    }
+
+    if (Path == "-") {
+        ErrorOr<std::unique_ptr<MemoryBuffer>> Merged = MemoryBuffer::getFile(MergedPath);
+        if (!Merged) return errorCodeToError(Merged.getError());
+        std::error_code EC;
+        raw_fd_ostream Out("-", EC, sys::fs::OF_None);
+        if (EC) return errorCodeToError(EC);
+        Out << (*Merged)->getBuffer();
+    }
+    return Error::success();
+}
+
+}  
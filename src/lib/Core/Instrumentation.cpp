@@ -0,0 +1,106 @@
+#include "Obfuscation/Instrumentation.h"
+#include "llvm/ADT/SetVector.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+#include <string>
+#include <vector>
+
+using namespace llvm;
+
+namespace obfuscator {
+
+static const char CounterPrefix[] = "__obf_prof.";
+
+void emitProfileIncrement(IRBuilder<> &Builder, Function &F, StringRef Kind, uint64_t Amount) {
+    Module *M = F.getParent();
+    Type *I64Ty = Type::getInt64Ty(M->getContext());
+    std::string Name = (CounterPrefix + Kind + "." + F.getName()).str();
+
+    GlobalVariable *GV = M->getGlobalVariable(Name, true);
+    if (!GV) {
+        GV = new GlobalVariable(*M, I64Ty, false, GlobalValue::InternalLinkage,
+                                ConstantInt::get(I64Ty, 0), Name, nullptr,
+                                GlobalValue::GeneralDynamicTLSModel);
+    }
+    Value *Old = Builder.CreateLoad(I64Ty, GV);
+    Builder.CreateStore(Builder.CreateAdd(Old, ConstantInt::get(I64Ty, Amount)), GV);
+}
+
+static Instruction *findSetupPoint(BasicBlock &Entry) {
+    for (Instruction &I : Entry) {
+        if (isa<PHINode>(&I) || isa<AllocaInst>(&I)) continue;
+        return &I;
+    }
+    return Entry.getTerminator();
+}
+
+void finalizeProfileInstrumentation(Module &M) {
+    LLVMContext &Ctx = M.getContext();
+    Type *I8Ty = Type::getInt8Ty(Ctx);
+    Type *I64Ty = Type::getInt64Ty(Ctx);
+
+    std::vector<GlobalVariable*> Counters;
+    SetVector<Function*> Instrumented;
+    std::string Desc;
+    for (GlobalVariable &GV : M.globals()) {
+        if (!GV.getName().starts_with(CounterPrefix)) continue;
+        StringRef Kind, Func;
+        std::tie(Kind, Func) = GV.getName().drop_front(sizeof(CounterPrefix) - 1).split('.');
+        Desc += (Func + "\t" + Kind + "\n").str();
+        Counters.push_back(&GV);
+        if (Function *F = M.getFunction(Func)) Instrumented.insert(F);
+    }
+    if (Counters.empty()) return;
+
+    Constant *DescInit = ConstantDataArray::getString(Ctx, Desc);
+    GlobalVariable *DescGV = new GlobalVariable(M, DescInit->getType(), true,
+        GlobalValue::PrivateLinkage, DescInit, "__obf_prof_desc");
+
+    PointerType *I64PtrTy = PointerType::getUnqual(I64Ty);
+    FunctionType *CollectTy = FunctionType::get(Type::getVoidTy(Ctx), {I64PtrTy}, false);
+    Function *Collect = Function::Create(CollectTy, GlobalValue::InternalLinkage,
+                                         "__obf_prof_collect", &M);
+    IRBuilder<> Builder(BasicBlock::Create(Ctx, "entry", Collect));
+    Value *Out = Collect->getArg(0);
+    for (size_t i = 0; i < Counters.size(); ++i) {
+        Value *Slot = Builder.CreateConstInBoundsGEP1_64(I64Ty, Out, i);
+        Value *Sum = Builder.CreateAdd(Builder.CreateLoad(I64Ty, Slot),
+                                       Builder.CreateLoad(I64Ty, Counters[i]));
+        Builder.CreateStore(Sum, Slot);
+        Builder.CreateStore(ConstantInt::get(I64Ty, 0), Counters[i]);
+    }
+    Builder.CreateRetVoid();
+
+    FunctionCallee Register = M.getOrInsertFunction("__obf_prof_register",
+        Type::getVoidTy(Ctx), PointerType::getUnqual(I8Ty), Type::getInt32Ty(Ctx),
+        PointerType::getUnqual(CollectTy));
+    Function *Init = Function::Create(FunctionType::get(Type::getVoidTy(Ctx), false),
+                                      GlobalValue::InternalLinkage, "__obf_prof_init", &M);
+    Builder.SetInsertPoint(BasicBlock::Create(Ctx, "entry", Init));
+    Builder.CreateCall(Register, {
+        Builder.CreatePointerCast(DescGV, PointerType::getUnqual(I8Ty)),
+        Builder.getInt32(Counters.size()),
+        Collect});
+    Builder.CreateRetVoid();
+    appendToGlobalCtors(M, Init, 0);
+
+    GlobalVariable *Ready = new GlobalVariable(M, I8Ty, false, GlobalValue::InternalLinkage,
+        ConstantInt::get(I8Ty, 0), "__obf_prof_ready", nullptr,
+        GlobalValue::GeneralDynamicTLSModel);
+    FunctionCallee ThreadInit = M.getOrInsertFunction("__obf_prof_thread_init",
+        Type::getVoidTy(Ctx));
+    for (Function *F : Instrumented) {
+        Instruction *IP = findSetupPoint(F->getEntryBlock());
+        Builder.SetInsertPoint(IP);
+        Value *IsReady = Builder.CreateICmpNE(Builder.CreateLoad(I8Ty, Ready),
+                                              ConstantInt::get(I8Ty, 0));
+        Instruction *Then = SplitBlockAndInsertIfThen(Builder.CreateNot(IsReady), IP, false);
+        Builder.SetInsertPoint(Then);
+        Builder.CreateCall(ThreadInit);
+        Builder.CreateStore(ConstantInt::get(I8Ty, 1), Ready);
+    }
+}
+
+}  
@@ -0,0 +1,233 @@
+#include "Obfuscation/JIT.h"
+#include "Obfuscation/CodeGen.h"
+#include "Obfuscation/Engine.h"
+#include "Obfuscation/Utils.h"
+#include "llvm/ExecutionEngine/Orc/CompileUtils.h"
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/ExecutionEngine/Orc/TargetProcess/TargetExecutionUtils.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include <algorithm>
+#include <chrono>
+#include <limits>
+
+using namespace llvm;
+
+namespace obfuscator {
+
+ObfuscationTransform::ObfuscationTransform(ObfuscationOptions Opts, FunctionPolicyHook::Callback Fn)
+    : Options(Opts) {
+    // One seed for the whole session, so a function comes out the same
+    // whichever partition or thread materializes it.
+    if (!Options.Seed) Options.Seed = Utils::randomSeed();
+    Options.FunctionPassesOnly = true;
+    Options.Instrument = false;
+    Options.Stats = nullptr;
+    Options.FnReport = nullptr;
+    Options.Verifier = nullptr;
+    Options.Layout = nullptr;
+    if (Fn) {
+        Hook.emplace(std::move(Fn));
+        Options.PolicyHook = &*Hook;
+    }
+}
+
+Error ObfuscationTransform::transform(Module &M) const {
+    ObfuscationEngine(Options).run(M);
+
+    std::string Msg;
+    raw_string_ostream OS(Msg);
+    if (verifyModule(M, &OS)) {
+        return createStringError(inconvertibleErrorCode(), "obfuscated %s does not verify: %s",
+                                 M.getModuleIdentifier().c_str(), OS.str().c_str());
+    }
+    return Error::success();
+}
+
+Expected<orc::ThreadSafeModule> ObfuscationTransform::operator()(orc::ThreadSafeModule TSM,
+                                                                 orc::MaterializationResponsibility &) {
+    if (Error E = TSM.withModuleDo([this](Module &M) { return transform(M); })) {
+        return std::move(E);
+    }
+    return std::move(TSM);
+}
+
+ObfuscationLayer::ObfuscationLayer(orc::ExecutionSession &ES, orc::IRLayer &BaseLayer,
+                                   ObfuscationTransform &Transform)
+    : IRTransformLayer(ES, BaseLayer,
+                       [&Transform](orc::ThreadSafeModule TSM, orc::MaterializationResponsibility &R) {
+                           return Transform(std::move(TSM), R);
+                       }) {}
+
+void installObfuscation(orc::LLJIT &J, ObfuscationTransform &Transform) {
+    J.getIRTransformLayer().setTransform(
+        [&Transform](orc::ThreadSafeModule TSM, orc::MaterializationResponsibility &R) {
+            return Transform(std::move(TSM), R);
+        });
+}
+
+Expected<int> runLazily(orc::ThreadSafeModule TSM, ObfuscationTransform &Transform, ArrayRef<std::string> Args,
+                        StringRef ProgramName) {
+    InitializeNativeTarget();
+    InitializeNativeTargetAsmPrinter();
+
+    Expected<std::unique_ptr<orc::LLLazyJIT>> J = orc::LLLazyJITBuilder().create();
+    if (!J) return J.takeError();
+    TSM.withModuleDo([&](Module &M) {
+        if (M.getTargetTriple().empty()) M.setTargetTriple((*J)->getTargetTriple().str());
+        if (M.getDataLayoutStr().empty()) M.setDataLayout((*J)->getDataLayout());
+    });
+
+    auto Host = orc::DynamicLibrarySearchGenerator::GetForCurrentProcess((*J)->getDataLayout().getGlobalPrefix());
+    if (!Host) return Host.takeError();
+    (*J)->getMainJITDylib().addGenerator(std::move(*Host));
+    installObfuscation(**J, Transform);
+
+    if (Error E = (*J)->addLazyIRModule(std::move(TSM))) return std::move(E);
+    auto Sym = (*J)->lookup("main");
+    if (!Sym) return Sym.takeError();
+    using MainFn = int (*)(int, char **);
+    return orc::runAsMain(Sym->toPtr<MainFn>(), Args, ProgramName);
+}
+
+static double elapsedUs(std::chrono::steady_clock::time_point Start) {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - Start).count();
+}
+
+// Clones F into a module of its own with every other global declared, as
+// the CompileOnDemandLayer does, then times the transform and the compile.
+static Error measureOnce(const Module &M, const Function &F, const ObfuscationTransform &Transform,
+                         TargetMachine &TM, JITLatencySample &Best) {
+    ValueToValueMapTy VMap;
+    std::unique_ptr<Module> Part = CloneModule(M, VMap, [&](const GlobalValue *GV) { return GV == &F; });
+
+    auto Start = std::chrono::steady_clock::now();
+    if (Error E = Transform.transform(*Part)) return E;
+    double TransformUs = elapsedUs(Start);
+
+    Start = std::chrono::steady_clock::now();
+    orc::SimpleCompiler Compile(TM);
+    auto Obj = Compile(*Part);
+    if (!Obj) return Obj.takeError();
+    double CompileUs = elapsedUs(Start);
+
+    if (TransformUs + CompileUs < Best.TransformUs + Best.CompileUs) {
+        Best.TransformUs = TransformUs;
+        Best.CompileUs = CompileUs;
+        Best.ObjectBytes = (*Obj)->getBufferSize();
+    }
+    return Error::success();
+}
+
+Expected<JITLatencyReport> measureJITLatency(const Module &Src, const ObfuscationOptions &Opts, unsigned Runs) {
+    std::unique_ptr<Module> M = CloneModule(Src);
+    Expected<std::unique_ptr<TargetMachine>> TMOrErr = createTargetMachine(*M);
+    if (!TMOrErr) return TMOrErr.takeError();
+
+    ObfuscationOptions BaseOpts;
+    BaseOpts.OptLevel = Opts.OptLevel;
+    BaseOpts.Seed = Opts.Seed;
+    ObfuscationTransform Baseline(BaseOpts);
+    ObfuscationTransform Obfuscated(Opts);
+
+    JITLatencyReport Report;
+    Report.Triple = M->getTargetTriple();
+    for (const Function &F : *M) {
+        if (F.isDeclaration()) continue;
+        JITFunctionLatency L;
+        L.Function = F.getName().str();
+        for (const BasicBlock &BB : F) L.Instrs += BB.size();
+        L.Baseline.TransformUs = L.Obfuscated.TransformUs = std::numeric_limits<double>::infinity();
+        for (unsigned i = 0; i < std::max(Runs, 1u) && L.Error.empty(); ++i) {
+            Error E = measureOnce(*M, F, Baseline, **TMOrErr, L.Baseline);
+            if (!E) E = measureOnce(*M, F, Obfuscated, **TMOrErr, L.Obfuscated);
+            if (E) L.Error = toString(std::move(E));
+        }
+        Report.Functions.push_back(std::move(L));
+    }
+    return std::move(Report);
+}
+
+static double totalUs(const JITLatencySample &S) { return S.TransformUs + S.CompileUs; }
+
+static double percentile(std::vector<double> &V, double P) {
+    if (V.empty()) return 0;
+    llvm::sort(V);
+    return V[std::min(V.size() - 1, static_cast<size_t>(P * (V.size() - 1) + 0.5))];
+}
+
+static void addSample(JITLatencySample &Total, const JITLatencySample &S) {
+    Total.TransformUs += S.TransformUs;
+    Total.CompileUs += S.CompileUs;
+    Total.ObjectBytes += S.ObjectBytes;
+}
+
+static void writeSample(json::OStream &J, StringRef Key, const JITLatencySample &S) {
+    J.attributeObject(Key, [&] {
+        J.attribute("transform_us", S.TransformUs);
+        J.attribute("compile_us", S.CompileUs);
+        J.attribute("total_us", totalUs(S));
+        J.attribute("object_bytes", static_cast<int64_t>(S.ObjectBytes));
+    });
+}
+
+static void writeDistribution(json::OStream &J, StringRef Key, std::vector<double> V) {
+    J.attributeObject(Key, [&] {
+        J.attribute("median_us", percentile(V, 0.5));
+        J.attribute("p90_us", percentile(V, 0.9));
+        J.attribute("max_us", V.empty() ? 0.0 : V.back());
+    });
+}
+
+void writeJITLatencyReport(raw_ostream &OS, const JITLatencyReport &Report) {
+    JITLatencySample BaseTotal, ObfTotal;
+    std::vector<double> BaseUs, ObfUs;
+    unsigned Failed = 0;
+    for (const JITFunctionLatency &L : Report.Functions) {
+        if (!L.Error.empty()) {
+            Failed++;
+            continue;
+        }
+        addSample(BaseTotal, L.Baseline);
+        addSample(ObfTotal, L.Obfuscated);
+        BaseUs.push_back(totalUs(L.Baseline));
+        ObfUs.push_back(totalUs(L.Obfuscated));
+    }
+
+    json::OStream J(OS, 2);
+    J.object([&] {
+        J.attribute("target", Report.Triple);
+        J.attribute("functions_measured", static_cast<int64_t>(BaseUs.size()));
+        J.attribute("functions_failed", static_cast<int64_t>(Failed));
+        J.attributeObject("total", [&] {
+            writeSample(J, "baseline", BaseTotal);
+            writeSample(J, "obfuscated", ObfTotal);
+            if (totalUs(BaseTotal) > 0) J.attribute("ratio", totalUs(ObfTotal) / totalUs(BaseTotal));
+            else J.attribute("ratio", nullptr);
+        });
+        J.attributeObject("per_function", [&] {
+            writeDistribution(J, "baseline", BaseUs);
+            writeDistribution(J, "obfuscated", ObfUs);
+        });
+        J.attributeArray("functions", [&] {
+            for (const JITFunctionLatency &L : Report.Functions) {
+                J.object([&] {
+                    J.attribute("function", L.Function);
+                    J.attribute("instructions", static_cast<int64_t>(L.Instrs));
+                    if (!L.Error.empty()) {
+                        J.attribute("error", L.Error);
+                        return;
+                    }
+                    writeSample(J, "baseline", L.Baseline);
+                    writeSample(J, "obfuscated", L.Obfuscated);
+                    J.attribute("ratio", totalUs(L.Baseline) > 0 ? totalUs(L.Obfuscated) / totalUs(L.Baseline) : 0.0);
+                });
+            }
+        });
+    });
+    OS << "\n";
+}
+
+}  
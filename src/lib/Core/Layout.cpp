@@ -0,0 +1,107 @@
+#include "Obfuscation/Layout.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/ProfileSummaryInfo.h"
+#include "llvm/IR/InstrTypes.h"
+#include "llvm/IR/Mangler.h"
+#include <algorithm>
+#include <tuple>
+#include <vector>
+
+using namespace llvm;
+
+namespace obfuscator {
+
+ 
+static const uint64_t HotCallWeight = 8;
+
+void FunctionLayout::analyze(Module &M, ModuleAnalysisManager &MAM) {
+    Functions.clear();
+    ProfileSummaryInfo &PSI = MAM.getResult<ProfileSummaryAnalysis>(M);
+    FunctionAnalysisManager &FAM =
+        MAM.getResult<FunctionAnalysisManagerModuleProxy>(M).getManager();
+
+    for (Function &F : M) {
+        if (F.isDeclaration()) continue;
+        Info &I = Functions[F.getName()];
+        if (PSI.hasProfileSummary()) {
+            if (auto Count = F.getEntryCount()) I.Score = Count->getCount();
+            if (PSI.isFunctionEntryHot(&F)) I.Temp = Hot;
+            else if (PSI.isFunctionEntryCold(&F)) I.Temp = Cold;
+        }
+    }
+    if (PSI.hasProfileSummary()) return;
+
+     
+    for (Function &F : M) {
+        if (F.isDeclaration()) continue;
+        LoopInfo &LI = FAM.getResult<LoopAnalysis>(F);
+        for (BasicBlock &BB : F) {
+            uint64_t Weight = 1ULL << (3 * std::min(LI.getLoopDepth(&BB), 6u));
+            for (Instruction &Inst : BB) {
+                auto *CB = dyn_cast<CallBase>(&Inst);
+                Function *Callee = CB ? CB->getCalledFunction() : nullptr;
+                if (!Callee || Callee->isDeclaration()) continue;
+                Functions[Callee->getName()].Score += Weight;
+            }
+        }
+    }
+    for (Function &F : M) {
+        if (F.isDeclaration()) continue;
+        Info &I = Functions[F.getName()];
+        if (F.getName() == "main") I.Score = std::max<uint64_t>(I.Score, 1);
+        if (F.hasFnAttribute(Attribute::Hot) || I.Score >= HotCallWeight) I.Temp = Hot;
+        if (F.hasFnAttribute(Attribute::Cold) ||
+            (I.Score == 0 && F.hasLocalLinkage() && !F.hasAddressTaken())) I.Temp = Cold;
+    }
+}
+
+void FunctionLayout::touched(const Function &F) {
+    auto It = Functions.find(F.getName());
+    if (It != Functions.end()) It->second.Touched = true;
+}
+
+bool FunctionLayout::isTouched(const Function &F) const {
+    auto It = Functions.find(F.getName());
+    return It == Functions.end() || It->second.Touched;
+}
+
+FunctionLayout::Temperature FunctionLayout::getTemperature(const Function &F) const {
+    auto It = Functions.find(F.getName());
+    return It == Functions.end() ? Cold : It->second.Temp;
+}
+
+uint64_t FunctionLayout::getScore(const Function &F) const {
+    auto It = Functions.find(F.getName());
+    return It == Functions.end() ? 0 : It->second.Score;
+}
+
+void FunctionLayout::apply(Module &M) {
+    if (!SectionHints) return;
+    for (Function &F : M) {
+        if (F.isDeclaration() || F.hasSection() || !isTouched(F)) continue;
+        switch (getTemperature(F)) {
+        case Hot: F.setSectionPrefix("hot"); break;
+        case Cold: F.setSectionPrefix("unlikely"); break;
+        case Normal: break;
+        }
+    }
+}
+
+void FunctionLayout::writeOrderFile(raw_ostream &OS, const Module &M) const {
+    std::vector<const Function*> Order;
+    for (const Function &F : M) {
+        if (!F.isDeclaration() && isTouched(F)) Order.push_back(&F);
+    }
+    std::stable_sort(Order.begin(), Order.end(), [&](const Function *A, const Function *B) {
+        return std::make_tuple(getTemperature(*A), ~getScore(*A)) <
+               std::make_tuple(getTemperature(*B), ~getScore(*B));
+    });
+
+    Mangler Mang;
+    for (const Function *F : Order) {
+        Mang.getNameWithPrefix(OS, F, false);
+        OS << "\n";
+    }
+}
+
+}  
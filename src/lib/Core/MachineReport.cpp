@@ -0,0 +1,214 @@
+#include "Obfuscation/MachineReport.h"
+#include "Obfuscation/CodeGen.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/CodeGen/MachineFunction.h"
+#include "llvm/CodeGen/MachineFunctionPass.h"
+#include "llvm/CodeGen/MachineJumpTableInfo.h"
+#include "llvm/CodeGen/MachineModuleInfo.h"
+#include "llvm/CodeGen/Passes.h"
+#include "llvm/CodeGen/TargetPassConfig.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Mangler.h"
+#include "llvm/Object/ObjectFile.h"
+#include "llvm/Object/SymbolSize.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include <algorithm>
+#include <vector>
+
+using namespace llvm;
+
+namespace obfuscator {
+
+namespace {
+
+// Runs after the last machine pass, right before the AsmPrinter.
+class MachineStatsPass : public MachineFunctionPass {
+public:
+    static char ID;
+
+    explicit MachineStatsPass(StringMap<MachineFunctionStats> &Functions)
+        : MachineFunctionPass(ID), Functions(Functions) {}
+
+    StringRef getPassName() const override { return "Obfuscation machine stats"; }
+
+    void getAnalysisUsage(AnalysisUsage &AU) const override {
+        AU.setPreservesAll();
+        MachineFunctionPass::getAnalysisUsage(AU);
+    }
+
+    bool runOnMachineFunction(MachineFunction &MF) override {
+        MachineFunctionStats &S = Functions[MF.getName()];
+        for (const MachineBasicBlock &MBB : MF) {
+            for (const MachineInstr &MI : MBB) {
+                if (MI.isMetaInstruction()) continue;
+                S.Instrs++;
+                if (MI.mayLoad()) S.Loads++;
+                if (MI.mayStore()) S.Stores++;
+                if (MI.isBranch()) S.Branches++;
+                if (MI.isIndirectBranch()) S.IndirectBranches++;
+            }
+        }
+        if (const MachineJumpTableInfo *JTI = MF.getJumpTableInfo()) {
+            unsigned EntrySize = JTI->getEntrySize(MF.getDataLayout());
+            for (const MachineJumpTableEntry &JT : JTI->getJumpTables()) {
+                S.JumpTableBytes += JT.MBBs.size() * EntrySize;
+            }
+        }
+        return false;
+    }
+
+private:
+    StringMap<MachineFunctionStats> &Functions;
+};
+
+char MachineStatsPass::ID = 0;
+
+}
+
+Expected<MachineModuleStats> collectMachineStats(const Module &Src) {
+    std::unique_ptr<Module> M = CloneModule(Src);
+    Expected<std::unique_ptr<TargetMachine>> TMOrErr = createTargetMachine(*M);
+    if (!TMOrErr) return TMOrErr.takeError();
+    auto &TM = static_cast<LLVMTargetMachine &>(**TMOrErr);
+
+    MachineModuleStats Stats;
+    Stats.Triple = M->getTargetTriple();
+
+    StringMap<std::string> SymbolToFunction;
+    Mangler Mang;
+    for (const Function &F : *M) {
+        if (F.isDeclaration()) continue;
+        SmallString<64> Symbol;
+        Mang.getNameWithPrefix(Symbol, &F, false);
+        SymbolToFunction[Symbol] = F.getName().str();
+    }
+
+    SmallVector<char, 0> Buffer;
+    raw_svector_ostream OS(Buffer);
+    legacy::PassManager PM;
+    auto *MMIWP = new MachineModuleInfoWrapperPass(&TM);
+    TargetPassConfig *PassConfig = TM.createPassConfig(PM);
+    PM.add(PassConfig);
+    PM.add(MMIWP);
+    if (PassConfig->addISelPasses()) {
+        return createStringError(inconvertibleErrorCode(), "%s: no instruction selector",
+                                 Stats.Triple.c_str());
+    }
+    PassConfig->addMachinePasses();
+    PassConfig->setInitialized();
+    PM.add(new MachineStatsPass(Stats.Functions));
+    if (TM.addAsmPrinter(PM, OS, nullptr, CodeGenFileType::ObjectFile, MMIWP->getMMI().getContext())) {
+        return createStringError(inconvertibleErrorCode(), "%s: cannot emit object files",
+                                 Stats.Triple.c_str());
+    }
+    PM.add(createFreeMachineFunctionPass());
+    PM.run(*M);
+
+    Expected<std::unique_ptr<object::ObjectFile>> Obj = object::ObjectFile::createObjectFile(
+        MemoryBufferRef(StringRef(Buffer.data(), Buffer.size()), "machine-stats"));
+    if (!Obj) return Obj.takeError();
+    for (const auto &SymSize : object::computeSymbolSizes(**Obj)) {
+        Expected<object::SymbolRef::Type> Type = SymSize.first.getType();
+        if (!Type) {
+            consumeError(Type.takeError());
+            continue;
+        }
+        if (*Type != object::SymbolRef::ST_Function) continue;
+        Expected<StringRef> Name = SymSize.first.getName();
+        if (!Name) {
+            consumeError(Name.takeError());
+            continue;
+        }
+        auto It = SymbolToFunction.find(*Name);
+        if (It != SymbolToFunction.end()) Stats.Functions[It->second].TextBytes = SymSize.second;
+    }
+    return std::move(Stats);
+}
+
+static const struct {
+    const char *Key;
+    uint64_t (*Get)(const MachineFunctionStats &);
+} Fields[] = {
+    {"text_bytes", [](const MachineFunctionStats &S) -> uint64_t { return S.TextBytes; }},
+    {"jump_table_bytes", [](const MachineFunctionStats &S) -> uint64_t { return S.JumpTableBytes; }},
+    {"instructions", [](const MachineFunctionStats &S) -> uint64_t { return S.Instrs; }},
+    {"loads", [](const MachineFunctionStats &S) -> uint64_t { return S.Loads; }},
+    {"stores", [](const MachineFunctionStats &S) -> uint64_t { return S.Stores; }},
+    {"branches", [](const MachineFunctionStats &S) -> uint64_t { return S.Branches; }},
+    {"indirect_branches", [](const MachineFunctionStats &S) -> uint64_t { return S.IndirectBranches; }},
+};
+
+static void addStats(MachineFunctionStats &Total, const MachineFunctionStats &S) {
+    Total.TextBytes += S.TextBytes;
+    Total.JumpTableBytes += S.JumpTableBytes;
+    Total.Instrs += S.Instrs;
+    Total.Loads += S.Loads;
+    Total.Stores += S.Stores;
+    Total.Branches += S.Branches;
+    Total.IndirectBranches += S.IndirectBranches;
+}
+
+static void writeStats(json::OStream &J, StringRef Key, const MachineFunctionStats *S) {
+    if (!S) {
+        J.attribute(Key, nullptr);
+        return;
+    }
+    J.attributeObject(Key, [&] {
+        for (const auto &F : Fields) J.attribute(F.Key, static_cast<int64_t>(F.Get(*S)));
+    });
+}
+
+static void writeRatios(json::OStream &J, const MachineFunctionStats &Before,
+                        const MachineFunctionStats &After) {
+    J.attributeObject("ratio", [&] {
+        for (const auto &F : Fields) {
+            uint64_t B = F.Get(Before);
+            if (B) J.attribute(F.Key, static_cast<double>(F.Get(After)) / B);
+            else J.attribute(F.Key, nullptr);
+        }
+    });
+}
+
+void writeMachineReport(raw_ostream &OS, const MachineModuleStats &Baseline,
+                        const MachineModuleStats &Obfuscated) {
+    std::vector<StringRef> Names;
+    MachineFunctionStats BaseTotal, ObfTotal;
+    for (const auto &E : Baseline.Functions) {
+        Names.push_back(E.getKey());
+        addStats(BaseTotal, E.getValue());
+    }
+    for (const auto &E : Obfuscated.Functions) {
+        if (!Baseline.Functions.count(E.getKey())) Names.push_back(E.getKey());
+        addStats(ObfTotal, E.getValue());
+    }
+    llvm::sort(Names);
+
+    json::OStream J(OS, 2);
+    J.object([&] {
+        J.attribute("target", Obfuscated.Triple);
+        J.attributeObject("total", [&] {
+            writeStats(J, "baseline", &BaseTotal);
+            writeStats(J, "obfuscated", &ObfTotal);
+            writeRatios(J, BaseTotal, ObfTotal);
+        });
+        J.attributeArray("functions", [&] {
+            for (StringRef Name : Names) {
+                auto B = Baseline.Functions.find(Name);
+                auto O = Obfuscated.Functions.find(Name);
+                const MachineFunctionStats *Before = B == Baseline.Functions.end() ? nullptr : &B->getValue();
+                const MachineFunctionStats *After = O == Obfuscated.Functions.end() ? nullptr : &O->getValue();
+                J.object([&] {
+                    J.attribute("function", Name);
+                    writeStats(J, "baseline", Before);
+                    writeStats(J, "obfuscated", After);
+                    if (Before && After) writeRatios(J, *Before, *After);
+                });
+            }
+        });
+    });
+    OS << "\n";
+}
+
+}  
@@ -1,5 +1,19 @@
+#include "Obfuscation/Engine.h"
 #include "Obfuscation/Config.h"
+#include "Obfuscation/CodeGen.h"
+#include "Obfuscation/Instrumentation.h"
+#include "Obfuscation/Layout.h"
+#include "Obfuscation/Outlining.h"
 #include "Obfuscation/Passes.h"
+#include "Obfuscation/Policy.h"
+#include "Obfuscation/RegisterPressure.h"
+#include "Obfuscation/Report.h"
+#include "Obfuscation/Utils.h"
+#include "Obfuscation/Verification.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/PostDominators.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/IR/Dominators.h"
 #include "llvm/IR/PassManager.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
@@ -8,66 +22,187 @@ using namespace llvm;
 
 namespace obfuscator {
 
-class ObfuscationEngine {
-public:
-    explicit ObfuscationEngine(ObfuscationOptions Opts) : Options(Opts) {}
-
-    void run(Module &M) {
-        LoopAnalysisManager LAM;
-        FunctionAnalysisManager FAM;
-        CGSCCAnalysisManager CGAM;
-        ModuleAnalysisManager MAM;
-
-        PassBuilder PB;
-        PB.registerModuleAnalyses(MAM);
-        PB.registerCGSCCAnalyses(CGAM);
-        PB.registerFunctionAnalyses(FAM);
-        PB.registerLoopAnalyses(LAM);
-        PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
-
-        ModulePassManager MPM;
-
-        if (Options.Stats) {
-            for(auto &F : M) {
-                Options.Stats->OrgFunctions++;
-                if (!F.isDeclaration()) {
-                    Options.Stats->OrgBlocks += F.size();
-                    for(auto &BB : F) Options.Stats->OrgInstrs += BB.size();
-                }
-            }
+static void countModule(Module &M, int &Functions, int &Blocks, int &Instrs) {
+    for (auto &F : M) {
+        Functions++;
+        if (!F.isDeclaration()) {
+            Blocks += F.size();
+            for (auto &BB : F) Instrs += BB.size();
         }
+    }
+}
 
-        if (Options.EnableStr) {
-            MPM.addPass(StringEncryptionPass(Options));
-        }
+// The -O0 pipeline runs only the obfuscation passes, which need the proxies
+// the function adaptor uses and the analyses they look up from the cache.
+// Registering these alone skips building the full PassBuilder analysis set.
+// TargetIRAnalysis uses the engine's target machine when it made one; only
+// the register pressure check asks for it, and that check needs one.
+static void registerBasicAnalyses(ModuleAnalysisManager &MAM, FunctionAnalysisManager &FAM,
+                                  PassInstrumentationCallbacks &PIC, TargetMachine *TM) {
+    MAM.registerPass([&] { return FunctionAnalysisManagerModuleProxy(FAM); });
+    MAM.registerPass([&] { return PassInstrumentationAnalysis(&PIC); });
+    FAM.registerPass([&] { return ModuleAnalysisManagerFunctionProxy(MAM); });
+    FAM.registerPass([&] { return PassInstrumentationAnalysis(&PIC); });
+    FAM.registerPass([] { return DominatorTreeAnalysis(); });
+    FAM.registerPass([] { return PostDominatorTreeAnalysis(); });
+    FAM.registerPass([] { return LoopAnalysis(); });
+    FAM.registerPass([TM] { return TM ? TM->getTargetIRAnalysis() : TargetIRAnalysis(); });
+}
 
-        if (Options.EnableInd) {
-            MPM.addPass(IndirectCallPass(Options));
-        }
+static bool placedAt(PipelinePlacement P, std::optional<PipelinePlacement> At) {
+    return !At || P == *At;
+}
 
-        FunctionPassManager FPM;
-        
-        if (Options.EnableSub) {
-            FPM.addPass(SubstitutionPass(Options));
-        }
-        
-        if (Options.EnableBcf) {
-            FPM.addPass(BogusControlFlowPass(Options));
-        }
-        
-        if (Options.EnableFla) {
-            FPM.addPass(FlatteningPass(Options));
+void ObfuscationEngine::addFunctionPasses(FunctionPassManager &FPM,
+                                          std::optional<PipelinePlacement> At) {
+    PassPolicy Pipeline = getPipelinePolicy(Options);
+    bool Sub = Pipeline.EnableSub && placedAt(Options.SubPlacement, At);
+    bool Bcf = Pipeline.EnableBcf && placedAt(Options.BcfPlacement, At);
+    bool Fla = Pipeline.EnableFla && placedAt(Options.FlaPlacement, At);
+    if (!Sub && !Bcf && !Fla) return;
+
+    if (Options.FnReport) {
+        FPM.addPass(FunctionReportBeginPass(*Options.FnReport));
+    }
+
+    if (Options.FnTimeLimitMs || Options.FnGrowthLimit > 0) {
+        FPM.addPass(FunctionWatchdogPass(Options, Sub, Bcf, Fla));
+        Sub = Bcf = Fla = false;
+    }
+    
+    if (Sub) {
+        FPM.addPass(SubstitutionPass(Options));
+    }
+    
+    if (Bcf) {
+        FPM.addPass(BogusControlFlowPass(Options));
+    }
+    
+    if (Fla) {
+        FPM.addPass(FlatteningPass(Options));
+    }
+
+    if (Options.FnReport) {
+        FPM.addPass(FunctionReportEndPass(*Options.FnReport));
+    }
+}
+
+void ObfuscationEngine::addModulePasses(ModulePassManager &MPM,
+                                        std::optional<PipelinePlacement> At) {
+    PassPolicy Pipeline = getPipelinePolicy(Options);
+    if (Options.FunctionPassesOnly) Pipeline.EnableStr = Pipeline.EnableInd = false;
+    if (Pipeline.EnableStr && placedAt(Options.StrPlacement, At)) {
+        MPM.addPass(StringEncryptionPass(Options));
+    }
+
+    if (Pipeline.EnableInd && placedAt(Options.IndPlacement, At)) {
+        MPM.addPass(IndirectCallPass(Options));
+    }
+
+    FunctionPassManager FPM;
+    addFunctionPasses(FPM, At);
+    if (!FPM.isEmpty()) {
+        MPM.addPass(createModuleToFunctionPassAdaptor(std::move(FPM)));
+    }
+}
+
+void ObfuscationEngine::run(Module &M) {
+    if (!Options.Seed) Options.Seed = Utils::randomSeed();
+
+    LoopAnalysisManager LAM;
+    FunctionAnalysisManager FAM;
+    CGSCCAnalysisManager CGAM;
+    ModuleAnalysisManager MAM;
+
+    PassInstrumentationCallbacks PIC;
+    if (Options.Verifier) {
+        Options.Verifier->registerCallbacks(PIC);
+    }
+
+    if (Options.Stats) {
+        countModule(M, Options.Stats->OrgFunctions, Options.Stats->OrgBlocks,
+                    Options.Stats->OrgInstrs);
+    }
+
+    // Analyses registered by the PassBuilder refer to it and to the target
+    // machine, so both live until the pipeline has run.
+    std::unique_ptr<TargetMachine> TM;
+    std::unique_ptr<PassBuilder> PB;
+    ModulePassManager MPM;
+
+    if (Options.Outline) {
+        createOutlinedHelpers(M, Options);
+    }
+
+    if (Options.OptLevel > 0 || (Options.RegPressure && hasTargetInfo(M))) {
+        Expected<std::unique_ptr<TargetMachine>> TMOrErr = createTargetMachine(M);
+        if (TMOrErr) TM = std::move(*TMOrErr);
+        else consumeError(TMOrErr.takeError());
+    }
+    // Without a target machine TargetIRAnalysis has only generic register
+    // counts, so the pressure check is left off.
+    if (!TM || !hasTargetInfo(M)) Options.RegPressure = false;
+
+    if (Options.OptLevel <= 0 && !Options.Layout) {
+        addModulePasses(MPM, std::nullopt);
+        if (!MPM.isEmpty()) registerBasicAnalyses(MAM, FAM, PIC, TM.get());
+    } else {
+        PB.reset(new PassBuilder(TM.get(), PipelineTuningOptions(), {}, &PIC));
+        PB->registerModuleAnalyses(MAM);
+        PB->registerCGSCCAnalyses(CGAM);
+        PB->registerFunctionAnalyses(FAM);
+        PB->registerLoopAnalyses(LAM);
+        PB->crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+        if (Options.Layout) {
+            Options.Layout->analyze(M, MAM);
         }
 
-        if (!FPM.isEmpty()) {
-            MPM.addPass(createModuleToFunctionPassAdaptor(std::move(FPM)));
+        if (Options.OptLevel <= 0) {
+            addModulePasses(MPM, std::nullopt);
+        } else {
+            PB->registerPipelineStartEPCallback([this](ModulePassManager &MPM, OptimizationLevel) {
+                addModulePasses(MPM, PipelinePlacement::PipelineStart);
+            });
+            PB->registerScalarOptimizerLateEPCallback([this](FunctionPassManager &FPM, OptimizationLevel) {
+                addFunctionPasses(FPM, PipelinePlacement::ScalarOptimizerLate);
+            });
+            PB->registerVectorizerStartEPCallback([this](FunctionPassManager &FPM, OptimizationLevel) {
+                addFunctionPasses(FPM, PipelinePlacement::VectorizerStart);
+            });
+            PB->registerOptimizerLastEPCallback([this](ModulePassManager &MPM, OptimizationLevel) {
+                addModulePasses(MPM, PipelinePlacement::OptimizerLast);
+            });
+
+            OptimizationLevel Level = Options.OptLevel == 1 ? OptimizationLevel::O1
+                                    : Options.OptLevel == 2 ? OptimizationLevel::O2
+                                                            : OptimizationLevel::O3;
+            MPM = PB->buildPerModuleDefaultPipeline(Level);
         }
+    }
+
+    if (!MPM.isEmpty()) MPM.run(M, MAM);
+    // The caller reports the failure; finishing the module would only build
+    // on broken IR.
+    if (Options.Verifier && Options.Verifier->failed()) return;
 
-        MPM.run(M, MAM);
+    if (Options.Outline) {
+        finalizeOutlinedHelpers(M);
     }
 
-private:
-    ObfuscationOptions Options;
-};
+    if (Options.Instrument) {
+        finalizeProfileInstrumentation(M);
+        if (Options.Verifier) Options.Verifier->checkModule(M, "instrument");
+    }
+
+    if (Options.Layout) {
+        Options.Layout->apply(M);
+    }
+
+    if (Options.Stats) {
+        countModule(M, Options.Stats->NewFunctions, Options.Stats->NewBlocks,
+                    Options.Stats->NewInstrs);
+    }
+}
 
 }  
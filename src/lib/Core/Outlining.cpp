@@ -0,0 +1,129 @@
+#include "Obfuscation/Outlining.h"
+#include "Obfuscation/Policy.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+#include <string>
+#include <vector>
+
+using namespace llvm;
+
+namespace obfuscator {
+
+static const char HelperPrefix[] = "outlined_";
+static const char OpaqueHelper[] = "outlined_opaque_pred";
+static const char OpaqueGlobal[] = "opaque_x";
+
+// Each helper evaluates a different always-true predicate family over
+// y = x + k, x loaded from its own global and k passed by the call site.
+// Sites pick a helper at random, so patching one helper to return true
+// strips only part of the bogus flow.
+using PredicateFamily = Value *(*)(IRBuilder<> &Builder, Value *Y);
+
+// y * (y + 1) is a product of consecutive integers, so it is even.
+static Value *consecutiveProductIsEven(IRBuilder<> &Builder, Value *Y) {
+    Type *Ty = Y->getType();
+    Value *Prod = Builder.CreateMul(Y, Builder.CreateAdd(Y, ConstantInt::get(Ty, 1)));
+    Value *Mod = Builder.CreateSRem(Prod, ConstantInt::get(Ty, 2));
+    return Builder.CreateICmpEQ(Mod, ConstantInt::get(Ty, 0));
+}
+
+// A square is 0 or 1 modulo 4, and 2^32 is a multiple of 4.
+static Value *squareModFourBelowTwo(IRBuilder<> &Builder, Value *Y) {
+    Type *Ty = Y->getType();
+    Value *Low = Builder.CreateAnd(Builder.CreateMul(Y, Y), ConstantInt::get(Ty, 3));
+    return Builder.CreateICmpULT(Low, ConstantInt::get(Ty, 2));
+}
+
+// 7a^2 - 1 is 3, 6 or 7 modulo 8 and a square is 0, 1 or 4, so they never
+// meet, even with 32-bit wraparound.
+static Value *sevenSquareMinusOneNotSquare(IRBuilder<> &Builder, Value *Y) {
+    Type *Ty = Y->getType();
+    Value *Lhs = Builder.CreateSub(Builder.CreateMul(ConstantInt::get(Ty, 7), Builder.CreateMul(Y, Y)),
+                                   ConstantInt::get(Ty, 1));
+    Value *B = Builder.CreateAdd(Y, ConstantInt::get(Ty, 1));
+    return Builder.CreateICmpNE(Lhs, Builder.CreateMul(B, B));
+}
+
+static const PredicateFamily Families[] = {
+    consecutiveProductIsEven,
+    squareModFourBelowTwo,
+    sevenSquareMinusOneNotSquare,
+};
+static const unsigned NumOpaqueHelpers = sizeof(Families) / sizeof(Families[0]);
+
+static std::string getOpaqueHelperName(unsigned I) {
+    return OpaqueHelper + std::to_string(I);
+}
+
+static Function *createOpaqueHelper(Module &M, uint64_t Seed, unsigned I) {
+    LLVMContext &Ctx = M.getContext();
+    Type *I32Ty = Type::getInt32Ty(Ctx);
+    GlobalVariable *GX = new GlobalVariable(M, I32Ty, false, GlobalValue::PrivateLinkage,
+        ConstantInt::get(I32Ty, RandomStream(Seed, "bcf", OpaqueGlobal, I).range(1, 100)), OpaqueGlobal);
+
+    Function *F = Function::Create(FunctionType::get(Type::getInt1Ty(Ctx), {I32Ty}, false),
+                                   GlobalValue::InternalLinkage, getOpaqueHelperName(I), &M);
+    F->addFnAttr(Attribute::NoInline);
+    F->addFnAttr(Attribute::NoUnwind);
+    F->addFnAttr(Attribute::WillReturn);
+    F->setOnlyReadsMemory();
+
+    IRBuilder<> Builder(BasicBlock::Create(Ctx, "entry", F));
+    Value *Y = Builder.CreateAdd(Builder.CreateLoad(I32Ty, GX), F->getArg(0));
+    Builder.CreateRet(Families[I](Builder, Y));
+    return F;
+}
+
+void createOutlinedHelpers(Module &M, const ObfuscationOptions &Options) {
+    if (!getPipelinePolicy(Options).EnableBcf || M.getFunction(getOpaqueHelperName(0))) return;
+    std::vector<GlobalValue*> Helpers;
+    for (unsigned I = 0; I < NumOpaqueHelpers; ++I) Helpers.push_back(createOpaqueHelper(M, Options.Seed, I));
+    appendToCompilerUsed(M, Helpers);
+}
+
+Value *emitOutlinedOpaquePredicate(IRBuilder<> &Builder, Module &M, RandomStream &RNG) {
+    Function *Helper = M.getFunction(getOpaqueHelperName(RNG.below(NumOpaqueHelpers)));
+    if (!Helper) return nullptr;
+    return Builder.CreateCall(Helper, {Builder.getInt32(RNG.range(0, 1 << 20))});
+}
+
+void finalizeOutlinedHelpers(Module &M) {
+    auto isHelper = [](const Value *V) {
+        const auto *F = dyn_cast<Function>(V->stripPointerCasts());
+        return F && F->getName().starts_with(HelperPrefix);
+    };
+
+    if (GlobalVariable *Used = M.getGlobalVariable("llvm.compiler.used")) {
+        std::vector<GlobalValue*> Keep;
+        bool Changed = false;
+        if (auto *Init = dyn_cast_or_null<ConstantArray>(Used->getInitializer())) {
+            for (const Use &U : Init->operands()) {
+                if (isHelper(U.get())) Changed = true;
+                else Keep.push_back(cast<GlobalValue>(U.get()->stripPointerCasts()));
+            }
+        }
+        if (Changed) {
+            Used->eraseFromParent();
+            if (!Keep.empty()) appendToCompilerUsed(M, Keep);
+        }
+    }
+
+    std::vector<Function*> Dead;
+    for (Function &F : M) {
+        if (!isHelper(&F)) continue;
+        F.removeDeadConstantUsers();
+        if (F.use_empty()) Dead.push_back(&F);
+    }
+    for (Function *F : Dead) F->eraseFromParent();
+
+    std::vector<GlobalVariable*> DeadGlobals;
+    for (GlobalVariable &GV : M.globals()) {
+        if (GV.hasPrivateLinkage() && GV.getName().starts_with(OpaqueGlobal) && GV.use_empty()) {
+            DeadGlobals.push_back(&GV);
+        }
+    }
+    for (GlobalVariable *GV : DeadGlobals) GV->eraseFromParent();
+}
+
+}  
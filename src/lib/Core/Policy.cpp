@@ -0,0 +1,704 @@
+#include "Obfuscation/Policy.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/YAMLParser.h"
+#include <algorithm>
+#include <cstring>
+#include <unordered_set>
+
+using namespace llvm;
+
+namespace obfuscator {
+
+static Error policyError(const Twine &Msg) {
+    return make_error<StringError>(Msg, inconvertibleErrorCode());
+}
+
+static const size_t MaxCachedStates = 1 << 16;
+
+// Thompson construction: every fragment has one entry and one dangling
+// epsilon exit that the caller links onward.
+class PatternParser {
+public:
+    using Node = PatternAutomaton::Node;
+    struct Frag { int Start, End; };
+
+    PatternParser(std::vector<Node> &Nodes, StringRef P, bool Regex)
+        : Nodes(Nodes), P(P), Regex(Regex) {}
+
+    Frag parse() {
+        if (!Regex) return parseGlob();
+
+        // Anchors belong to the top-level branch they start or end, so
+        // ^a|b$ is (^a)|(b$) as in other regex engines.
+        Frag F = parseBranch();
+        while (Pos < P.size() && P[Pos] == '|') {
+            ++Pos;
+            F = alt(F, parseBranch());
+        }
+        if (Pos < P.size()) fail("unmatched ')'");
+        return F;
+    }
+
+    std::string Err;
+
+private:
+    std::vector<Node> &Nodes;
+    StringRef P;
+    bool Regex;
+    size_t Pos = 0;
+
+    void fail(const char *Msg) {
+        if (Err.empty()) Err = Msg;
+        Pos = P.size();
+    }
+
+    int node() {
+        Nodes.emplace_back();
+        return static_cast<int>(Nodes.size() - 1);
+    }
+
+    Frag empty() {
+        int S = node();
+        return {S, S};
+    }
+
+    Frag bytes(const std::bitset<256> &B) {
+        int S = node(), E = node();
+        Nodes[S].Bytes = B;
+        Nodes[S].Epsilon = false;
+        Nodes[S].Out = E;
+        return {S, E};
+    }
+
+    Frag concat(Frag A, Frag B) {
+        Nodes[A.End].Out = B.Start;
+        return {A.Start, B.End};
+    }
+
+    Frag alt(Frag A, Frag B) {
+        int S = node(), E = node();
+        Nodes[S].Out = A.Start;
+        Nodes[S].Out1 = B.Start;
+        Nodes[A.End].Out = E;
+        Nodes[B.End].Out = E;
+        return {S, E};
+    }
+
+    Frag star(Frag A) {
+        int S = node(), E = node();
+        Nodes[S].Out = A.Start;
+        Nodes[S].Out1 = E;
+        Nodes[A.End].Out = S;
+        return {S, E};
+    }
+
+    Frag plus(Frag A) {
+        int S = node(), E = node();
+        Nodes[A.End].Out = S;
+        Nodes[S].Out = A.Start;
+        Nodes[S].Out1 = E;
+        return {A.Start, E};
+    }
+
+    Frag optional(Frag A) {
+        int S = node(), E = node();
+        Nodes[S].Out = A.Start;
+        Nodes[S].Out1 = E;
+        Nodes[A.End].Out = E;
+        return {S, E};
+    }
+
+    static std::bitset<256> any() { return std::bitset<256>().set(); }
+
+    static std::bitset<256> single(char C) {
+        return std::bitset<256>().set(static_cast<uint8_t>(C));
+    }
+
+    static bool escapeClass(char C, std::bitset<256> &B) {
+        std::bitset<256> R;
+        switch (C) {
+        case 'd': case 'D':
+            for (unsigned c = '0'; c <= '9'; ++c) R.set(c);
+            break;
+        case 'w': case 'W':
+            for (unsigned c = 0; c < 256; ++c) {
+                if (isAlnum(static_cast<char>(c)) || c == '_') R.set(c);
+            }
+            break;
+        case 's': case 'S':
+            for (char c : {' ', '\t', '\n', '\r', '\f', '\v'}) R.set(static_cast<uint8_t>(c));
+            break;
+        default:
+            return false;
+        }
+        B |= C == 'D' || C == 'W' || C == 'S' ? ~R : R;
+        return true;
+    }
+
+    std::bitset<256> parseClass() {
+        std::bitset<256> B;
+        bool Negate = Pos < P.size() && (P[Pos] == '^' || (!Regex && P[Pos] == '!'));
+        if (Negate) ++Pos;
+        bool First = true;
+        while (Pos < P.size() && (P[Pos] != ']' || First)) {
+            First = false;
+            uint8_t Lo = P[Pos++];
+            if (Lo == '\\' && Pos < P.size()) {
+                char E = P[Pos++];
+                if (Regex && escapeClass(E, B)) continue;
+                Lo = E;
+            }
+            uint8_t Hi = Lo;
+            if (Pos + 1 < P.size() && P[Pos] == '-' && P[Pos + 1] != ']') {
+                Hi = P[Pos + 1];
+                Pos += 2;
+                if (Hi == '\\' && Pos < P.size()) Hi = P[Pos++];
+            }
+            if (Hi < Lo) {
+                fail("invalid character range");
+                return B;
+            }
+            for (unsigned c = Lo; c <= Hi; ++c) B.set(c);
+        }
+        if (Pos >= P.size()) {
+            fail("unterminated character class");
+            return B;
+        }
+        ++Pos;
+        return Negate ? ~B : B;
+    }
+
+    Frag parseGlob() {
+        Frag F = empty();
+        while (Pos < P.size()) {
+            char C = P[Pos++];
+            if (C == '*') {
+                F = concat(F, star(bytes(any())));
+            } else if (C == '?') {
+                F = concat(F, bytes(any()));
+            } else if (C == '[') {
+                F = concat(F, bytes(parseClass()));
+            } else {
+                if (C == '\\' && Pos < P.size()) C = P[Pos++];
+                F = concat(F, bytes(single(C)));
+            }
+        }
+        return F;
+    }
+
+    Frag parseAlt() {
+        Frag F = parseConcat();
+        while (Pos < P.size() && P[Pos] == '|') {
+            ++Pos;
+            F = alt(F, parseConcat());
+        }
+        return F;
+    }
+
+    Frag parseBranch() {
+        bool Head = Pos < P.size() && P[Pos] == '^';
+        if (Head) ++Pos;
+        bool Tail = false;
+        Frag F = empty();
+        while (Pos < P.size() && P[Pos] != '|' && P[Pos] != ')') {
+            if (P[Pos] == '$' && (Pos + 1 == P.size() || P[Pos + 1] == '|')) {
+                ++Pos;
+                Tail = true;
+                break;
+            }
+            F = concat(F, parseRepeat());
+        }
+        if (!Head) F = concat(star(bytes(any())), F);
+        if (!Tail) F = concat(F, star(bytes(any())));
+        return F;
+    }
+
+    Frag parseConcat() {
+        Frag F = empty();
+        while (Pos < P.size() && P[Pos] != '|' && P[Pos] != ')') {
+            F = concat(F, parseRepeat());
+        }
+        return F;
+    }
+
+    Frag parseRepeat() {
+        Frag F = parseAtom();
+        while (Pos < P.size()) {
+            char C = P[Pos];
+            if (C == '*') F = star(F);
+            else if (C == '+') F = plus(F);
+            else if (C == '?') F = optional(F);
+            else if (C == '{') fail("counted repetition is not supported");
+            else break;
+            ++Pos;
+        }
+        return F;
+    }
+
+    Frag parseAtom() {
+        char C = P[Pos++];
+        switch (C) {
+        case '(': {
+            if (P.substr(Pos).starts_with("?:")) Pos += 2;
+            Frag F = parseAlt();
+            if (Pos >= P.size() || P[Pos] != ')') {
+                fail("missing ')'");
+                return F;
+            }
+            ++Pos;
+            return F;
+        }
+        case '[':
+            return bytes(parseClass());
+        case '.':
+            return bytes(any());
+        case '*': case '+': case '?':
+            fail("repetition without an operand");
+            return empty();
+        case '^': case '$':
+            fail("anchors are only supported at the ends of a top-level branch");
+            return empty();
+        case '\\': {
+            if (Pos >= P.size()) {
+                fail("trailing backslash");
+                return empty();
+            }
+            char E = P[Pos++];
+            std::bitset<256> B;
+            if (!escapeClass(E, B)) B.set(static_cast<uint8_t>(E));
+            return bytes(B);
+        }
+        default:
+            return bytes(single(C));
+        }
+    }
+};
+
+Error PatternAutomaton::add(StringRef Pattern, unsigned Id, bool Regex) {
+    PatternParser Parser(Nodes, Pattern, Regex);
+    PatternParser::Frag F = Parser.parse();
+    if (!Parser.Err.empty()) {
+        return policyError(Twine("invalid ") + (Regex ? "regex" : "glob") + " '" + Pattern +
+                           "': " + Parser.Err);
+    }
+    Nodes.emplace_back();
+    Nodes.back().Epsilon = false;
+    Nodes.back().Accept = static_cast<int>(Id);
+    Nodes[F.End].Out = static_cast<int>(Nodes.size() - 1);
+    Starts.push_back(F.Start);
+    return Error::success();
+}
+
+Error PatternAutomaton::addGlob(StringRef Pattern, unsigned Id) {
+    return add(Pattern, Id, false);
+}
+
+Error PatternAutomaton::addRegex(StringRef Pattern, unsigned Id) {
+    return add(Pattern, Id, true);
+}
+
+Error PatternAutomaton::compile() {
+    std::unordered_set<std::bitset<256>> Sets;
+    for (const Node &N : Nodes) {
+        if (!N.Epsilon && N.Accept < 0) Sets.insert(N.Bytes);
+    }
+    NumClasses = 1;
+    std::memset(ClassOf, 0, sizeof(ClassOf));
+    for (const std::bitset<256> &B : Sets) {
+        std::vector<int> Remap(NumClasses * 2, -1);
+        unsigned Count = 0;
+        for (unsigned c = 0; c < 256; ++c) {
+            int &Slot = Remap[ClassOf[c] * 2 + B[c]];
+            if (Slot < 0) Slot = Count++;
+            ClassOf[c] = static_cast<uint8_t>(Slot);
+        }
+        NumClasses = Count;
+    }
+    ClassRep.assign(NumClasses, 0);
+    for (unsigned c = 256; c-- > 0;) ClassRep[ClassOf[c]] = static_cast<uint8_t>(c);
+
+    Mark.assign(Nodes.size(), 0);
+    resetCache();
+    return Error::success();
+}
+
+std::vector<int> PatternAutomaton::closure(std::vector<int> &Stack) const {
+    ++Gen;
+    std::vector<int> Set;
+    while (!Stack.empty()) {
+        int N = Stack.back();
+        Stack.pop_back();
+        if (N < 0 || Mark[N] == Gen) continue;
+        Mark[N] = Gen;
+        if (!Nodes[N].Epsilon) {
+            Set.push_back(N);
+            continue;
+        }
+        Stack.push_back(Nodes[N].Out);
+        Stack.push_back(Nodes[N].Out1);
+    }
+    llvm::sort(Set);
+    return Set;
+}
+
+uint32_t PatternAutomaton::intern(std::vector<int> Set) const {
+    auto It = Index.try_emplace(std::move(Set), static_cast<uint32_t>(States.size()));
+    if (!It.second) return It.first->second;
+
+    States.push_back(&It.first->first);
+    std::vector<unsigned> Ids;
+    for (int N : It.first->first) {
+        if (Nodes[N].Accept >= 0) Ids.push_back(Nodes[N].Accept);
+    }
+    llvm::sort(Ids);
+    Ids.erase(std::unique(Ids.begin(), Ids.end()), Ids.end());
+    Accepts.push_back(std::move(Ids));
+    Next.resize(Next.size() + NumClasses, -1);
+    return It.first->second;
+}
+
+uint32_t PatternAutomaton::resetCache(std::vector<int> Keep) const {
+    Index.clear();
+    States.clear();
+    Accepts.clear();
+    Next.clear();
+    intern({});
+    std::vector<int> Seeds(Starts);
+    Start = intern(closure(Seeds));
+    return intern(std::move(Keep));
+}
+
+uint32_t PatternAutomaton::step(uint32_t S, unsigned Class) const {
+    int32_t T = Next[S * NumClasses + Class];
+    if (T >= 0) return static_cast<uint32_t>(T);
+
+    std::vector<int> Seeds;
+    for (int N : *States[S]) {
+        if (Nodes[N].Accept < 0 && Nodes[N].Bytes[ClassRep[Class]]) Seeds.push_back(Nodes[N].Out);
+    }
+    T = static_cast<int32_t>(intern(closure(Seeds)));
+    Next[S * NumClasses + Class] = T;
+    return static_cast<uint32_t>(T);
+}
+
+void PatternAutomaton::match(StringRef Name, SmallVectorImpl<unsigned> &Ids) const {
+    std::lock_guard<std::mutex> Guard(Lock);
+    uint32_t S = Start;
+    for (char C : Name) {
+        if (States.size() >= MaxCachedStates) S = resetCache(*States[S]);
+        S = step(S, ClassOf[static_cast<uint8_t>(C)]);
+        if (S == 0) return;
+    }
+    Ids.append(Accepts[S].begin(), Accepts[S].end());
+}
+
+PassPolicy::PassPolicy(const ObfuscationOptions &Opts)
+    : EnableStr(Opts.EnableStr), EnableSub(Opts.EnableSub), EnableInd(Opts.EnableInd),
+      EnableBcf(Opts.EnableBcf), EnableFla(Opts.EnableFla), FlaSplitNum(Opts.FlaSplitNum),
+      BcfProb(Opts.BcfProb), BcfLoop(Opts.BcfLoop), SubProb(Opts.SubProb) {}
+
+void PassPolicy::apply(const PolicyRule &R) {
+    if (R.Str) EnableStr = *R.Str;
+    if (R.Sub) EnableSub = *R.Sub;
+    if (R.Ind) EnableInd = *R.Ind;
+    if (R.Bcf) EnableBcf = *R.Bcf;
+    if (R.Fla) EnableFla = *R.Fla;
+    if (R.FlaSplitNum) FlaSplitNum = *R.FlaSplitNum;
+    if (R.BcfProb) BcfProb = *R.BcfProb;
+    if (R.BcfLoop) BcfLoop = *R.BcfLoop;
+    if (R.SubProb) SubProb = *R.SubProb;
+    Reason = R.Name;
+}
+
+ObfuscationPolicy::ObfuscationPolicy() {
+    PolicyRule Helper;
+    Helper.Name = "decrypt_helper";
+    Helper.Ind = Helper.Bcf = Helper.Fla = false;
+    Rules.push_back(Helper);
+    cantFail(Functions.addGlob("decrypt_*", 0));
+
+    PolicyRule Outlined;
+    Outlined.Name = "outlined_helper";
+    Outlined.Sub = Outlined.Ind = Outlined.Bcf = Outlined.Fla = false;
+    Rules.push_back(Outlined);
+    cantFail(Functions.addGlob("outlined_*", 1));
+}
+
+static std::optional<bool> *getPassSlot(PolicyRule &R, StringRef Pass) {
+    return Pass == "str" ? &R.Str
+         : Pass == "sub" ? &R.Sub
+         : Pass == "ind" ? &R.Ind
+         : Pass == "bcf" ? &R.Bcf
+         : Pass == "fla" ? &R.Fla
+                         : nullptr;
+}
+
+static Error forEachString(const json::Object &O, StringRef Key,
+                           function_ref<Error(StringRef)> Fn) {
+    const json::Value *V = O.get(Key);
+    if (!V) return Error::success();
+    if (auto S = V->getAsString()) return Fn(*S);
+    const json::Array *A = V->getAsArray();
+    if (A && llvm::all_of(*A, [](const json::Value &Item) { return bool(Item.getAsString()); })) {
+        for (const json::Value &Item : *A) {
+            if (Error E = Fn(*Item.getAsString())) return E;
+        }
+        return Error::success();
+    }
+    return policyError("\"" + Key + "\" must be a string or an array of strings");
+}
+
+Error ObfuscationPolicy::addRule(const json::Object &O, unsigned Index) {
+    static const StringRef Keys[] = {"name", "kind", "match", "regex", "module", "passes",
+                                     "str", "sub", "ind", "bcf", "fla",
+                                     "fla_split", "bcf_prob", "bcf_loop", "sub_prob"};
+    for (const auto &KV : O) {
+        StringRef Key = KV.first;
+        if (!is_contained(Keys, Key)) return policyError("unknown key \"" + Key + "\"");
+    }
+
+    PolicyRule R;
+    if (auto V = O.getString("name")) R.Name = V->str();
+    else R.Name = ("rule " + Twine(Index)).str();
+
+    StringRef Kind = "function";
+    if (auto V = O.getString("kind")) Kind = *V;
+    bool ForFunctions = Kind == "function" || Kind == "any";
+    bool ForGlobals = Kind == "global" || Kind == "any";
+    if (!ForFunctions && !ForGlobals) return policyError("\"kind\" must be function, global or any");
+
+    bool HasName = false;
+    auto addName = [&](StringRef Pattern, bool Regex) -> Error {
+        HasName = true;
+        if (ForFunctions) {
+            if (Error E = Regex ? Functions.addRegex(Pattern, Index) : Functions.addGlob(Pattern, Index)) return E;
+        }
+        if (ForGlobals) {
+            if (Error E = Regex ? Globals.addRegex(Pattern, Index) : Globals.addGlob(Pattern, Index)) return E;
+        }
+        return Error::success();
+    };
+    if (Error E = forEachString(O, "match", [&](StringRef P) { return addName(P, false); })) return E;
+    if (Error E = forEachString(O, "regex", [&](StringRef P) { return addName(P, true); })) return E;
+    if (!HasName) cantFail(addName("*", false));
+    if (Error E = forEachString(O, "module", [&](StringRef P) {
+            R.HasModule = true;
+            return Modules.addGlob(P, Index);
+        })) {
+        return E;
+    }
+
+    if (const json::Value *V = O.get("passes")) {
+        const json::Array *A = V->getAsArray();
+        if (!A) return policyError("\"passes\" must be an array");
+        R.Str = R.Sub = R.Ind = R.Bcf = R.Fla = false;
+        for (const json::Value &Item : *A) {
+            auto S = Item.getAsString();
+            std::optional<bool> *Slot = S ? getPassSlot(R, *S) : nullptr;
+            if (!Slot) return policyError("\"passes\" entries must be str, sub, ind, bcf or fla");
+            *Slot = true;
+        }
+    }
+    for (StringRef Pass : {"str", "sub", "ind", "bcf", "fla"}) {
+        const json::Value *V = O.get(Pass);
+        if (!V) continue;
+        auto B = V->getAsBoolean();
+        if (!B) return policyError("\"" + Pass + "\" must be a boolean");
+        *getPassSlot(R, Pass) = *B;
+    }
+
+    auto readInt = [&](StringRef Key, std::optional<int> &Out) -> Error {
+        const json::Value *V = O.get(Key);
+        if (!V) return Error::success();
+        auto I = V->getAsInteger();
+        if (!I) return policyError("\"" + Key + "\" must be an integer");
+        Out = static_cast<int>(*I);
+        return Error::success();
+    };
+    if (Error E = readInt("fla_split", R.FlaSplitNum)) return E;
+    if (Error E = readInt("bcf_prob", R.BcfProb)) return E;
+    if (Error E = readInt("bcf_loop", R.BcfLoop)) return E;
+    if (Error E = readInt("sub_prob", R.SubProb)) return E;
+
+    Rules.push_back(std::move(R));
+    return Error::success();
+}
+
+Error ObfuscationPolicy::compile() {
+    if (Error E = Functions.compile()) return E;
+    if (Error E = Globals.compile()) return E;
+    return Modules.compile();
+}
+
+static Expected<json::Value> toJSON(yaml::Node *N) {
+    if (auto *S = dyn_cast_or_null<yaml::ScalarNode>(N)) {
+        SmallString<64> Storage;
+        StringRef V = S->getValue(Storage);
+        StringRef Raw = S->getRawValue();
+        if (Raw.starts_with("\"") || Raw.starts_with("'")) return json::Value(V.str());
+        if (V == "true") return json::Value(true);
+        if (V == "false") return json::Value(false);
+        int64_t I;
+        if (!V.getAsInteger(10, I)) return json::Value(I);
+        double D;
+        if (!V.getAsDouble(D)) return json::Value(D);
+        return json::Value(V.str());
+    }
+    if (auto *S = dyn_cast_or_null<yaml::BlockScalarNode>(N)) {
+        return json::Value(S->getValue().str());
+    }
+    if (auto *Seq = dyn_cast_or_null<yaml::SequenceNode>(N)) {
+        json::Array A;
+        for (yaml::Node &Item : *Seq) {
+            Expected<json::Value> V = toJSON(&Item);
+            if (!V) return V.takeError();
+            A.push_back(std::move(*V));
+        }
+        return json::Value(std::move(A));
+    }
+    if (auto *Map = dyn_cast_or_null<yaml::MappingNode>(N)) {
+        json::Object O;
+        for (yaml::KeyValueNode &KV : *Map) {
+            auto *Key = dyn_cast_or_null<yaml::ScalarNode>(KV.getKey());
+            if (!Key) return policyError("mapping keys must be plain scalars");
+            SmallString<32> KeyStorage;
+            StringRef K = Key->getValue(KeyStorage);
+            Expected<json::Value> V = toJSON(KV.getValue());
+            if (!V) return V.takeError();
+            O[K.str()] = std::move(*V);
+        }
+        return json::Value(std::move(O));
+    }
+    if (isa_and_nonnull<yaml::NullNode>(N)) return json::Value(nullptr);
+    return policyError("unsupported YAML node (anchors and aliases are not supported)");
+}
+
+static Expected<json::Value> parseYAML(StringRef Buffer) {
+    SourceMgr SM;
+    std::string Diag;
+    SM.setDiagHandler([](const SMDiagnostic &D, void *Ctx) {
+        std::string &Out = *static_cast<std::string *>(Ctx);
+        if (Out.empty()) Out = (Twine(D.getLineNo()) + ":" + Twine(D.getColumnNo() + 1) + ": " + D.getMessage()).str();
+    }, &Diag);
+
+    yaml::Stream S(Buffer, SM, false);
+    yaml::document_iterator DI = S.begin();
+    if (DI == S.end()) return policyError("empty YAML document");
+    Expected<json::Value> Root = toJSON(DI->getRoot());
+    if (S.failed()) {
+        if (!Root) consumeError(Root.takeError());
+        return policyError(Diag.empty() ? "malformed YAML" : Diag);
+    }
+    return Root;
+}
+
+Expected<std::unique_ptr<ObfuscationPolicy>> ObfuscationPolicy::load(StringRef Path) {
+    auto Buf = MemoryBuffer::getFile(Path);
+    if (!Buf) return errorCodeToError(Buf.getError());
+    StringRef Ext = sys::path::extension(Path);
+    auto Policy = parse((*Buf)->getBuffer(), Ext == ".yaml" || Ext == ".yml");
+    if (!Policy) return policyError(Path + ": " + toString(Policy.takeError()));
+    return Policy;
+}
+
+Expected<std::unique_ptr<ObfuscationPolicy>> ObfuscationPolicy::parse(StringRef Buffer, bool Yaml) {
+    Expected<json::Value> Root = Yaml ? parseYAML(Buffer) : json::parse(Buffer);
+    if (!Root) return Root.takeError();
+
+    const json::Object *O = Root->getAsObject();
+    const json::Array *Rules = O ? O->getArray("rules") : nullptr;
+    if (!Rules) return policyError("missing \"rules\" array");
+
+    std::unique_ptr<ObfuscationPolicy> Policy(new ObfuscationPolicy());
+    for (size_t i = 0; i < Rules->size(); ++i) {
+        const json::Object *R = (*Rules)[i].getAsObject();
+        if (!R) return policyError("rule " + Twine(i + 1) + ": not an object");
+        if (Error E = Policy->addRule(*R, static_cast<unsigned>(Policy->Rules.size()))) {
+            return policyError("rule " + Twine(i + 1) + ": " + toString(std::move(E)));
+        }
+    }
+    if (Error E = Policy->compile()) return std::move(E);
+    return std::move(Policy);
+}
+
+const ObfuscationPolicy &ObfuscationPolicy::getDefault() {
+    static const std::unique_ptr<ObfuscationPolicy> Default = [] {
+        std::unique_ptr<ObfuscationPolicy> P(new ObfuscationPolicy());
+        cantFail(P->compile());
+        return P;
+    }();
+    return *Default;
+}
+
+const PolicyRule *ObfuscationPolicy::lookup(const PatternAutomaton &Names, StringRef Name,
+                                            const Module &M) const {
+    SmallVector<unsigned, 8> Ids;
+    SmallVector<unsigned, 8> InModule;
+    bool ModuleMatched = false;
+    Names.match(Name, Ids);
+    for (unsigned Id : Ids) {
+        const PolicyRule &R = Rules[Id];
+        if (R.HasModule) {
+            if (!ModuleMatched) {
+                Modules.match(M.getSourceFileName(), InModule);
+                ModuleMatched = true;
+            }
+            if (!std::binary_search(InModule.begin(), InModule.end(), Id)) continue;
+        }
+        return &R;
+    }
+    return nullptr;
+}
+
+const PolicyRule *ObfuscationPolicy::lookup(const Function &F) const {
+    return lookup(Functions, F.getName(), *F.getParent());
+}
+
+const PolicyRule *ObfuscationPolicy::lookup(const GlobalVariable &GV) const {
+    return lookup(Globals, GV.getName(), *GV.getParent());
+}
+
+static const ObfuscationPolicy &getPolicy(const ObfuscationOptions &Opts) {
+    return Opts.Policy ? *Opts.Policy : ObfuscationPolicy::getDefault();
+}
+
+PassPolicy getFunctionPolicy(const ObfuscationOptions &Opts, const Function &F) {
+    PassPolicy P(Opts);
+    if (const PolicyRule *R = getPolicy(Opts).lookup(F)) P.apply(*R);
+    if (Opts.PolicyHook) (*Opts.PolicyHook)(F, P);
+    // Indirect calls have always skipped every decrypt* function, not only
+    // the decrypt_* helpers.
+    if (F.getName().starts_with("decrypt")) P.EnableInd = false;
+    if (F.hasFnAttribute(Attribute::OptimizeNone)) {
+        P.EnableBcf = P.EnableFla = false;
+        P.Reason = "optnone";
+    }
+    return P;
+}
+
+PassPolicy getGlobalPolicy(const ObfuscationOptions &Opts, const GlobalVariable &GV) {
+    PassPolicy P(Opts);
+    if (const PolicyRule *R = getPolicy(Opts).lookup(GV)) P.apply(*R);
+    return P;
+}
+
+PassPolicy getPipelinePolicy(const ObfuscationOptions &Opts) {
+    PassPolicy P(Opts);
+    for (const PolicyRule &R : getPolicy(Opts).rules()) {
+        P.EnableStr |= R.Str.value_or(false);
+        P.EnableSub |= R.Sub.value_or(false);
+        P.EnableInd |= R.Ind.value_or(false);
+        P.EnableBcf |= R.Bcf.value_or(false);
+        P.EnableFla |= R.Fla.value_or(false);
+    }
+    return P;
+}
+
+}  
@@ -0,0 +1,190 @@
+#include "Obfuscation/Presets.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+using namespace llvm;
+
+namespace obfuscator {
+
+const char *getLevelName(ObfuscationLevel Level) {
+    switch (Level) {
+    case ObfuscationLevel::None: return "none";
+    case ObfuscationLevel::Low: return "low";
+    case ObfuscationLevel::Medium: return "medium";
+    case ObfuscationLevel::High: return "high";
+    case ObfuscationLevel::Aggressive: return "aggressive";
+    case ObfuscationLevel::Insane: return "insane";
+    }
+    return "none";
+}
+
+const char *getPlacementName(PipelinePlacement P) {
+    switch (P) {
+    case PipelinePlacement::PipelineStart: return "start";
+    case PipelinePlacement::ScalarOptimizerLate: return "scalar-late";
+    case PipelinePlacement::VectorizerStart: return "vectorizer-start";
+    case PipelinePlacement::OptimizerLast: return "optimizer-last";
+    }
+    return "optimizer-last";
+}
+
+bool parsePlacementName(StringRef Name, PipelinePlacement &P) {
+    for (PipelinePlacement C : {PipelinePlacement::PipelineStart, PipelinePlacement::ScalarOptimizerLate,
+                                PipelinePlacement::VectorizerStart, PipelinePlacement::OptimizerLast}) {
+        if (Name == getPlacementName(C)) {
+            P = C;
+            return true;
+        }
+    }
+    return false;
+}
+
+OverheadBudget getOverheadBudget(ObfuscationLevel Level) {
+    switch (Level) {
+    case ObfuscationLevel::None: return {1.0, 1.0};
+    case ObfuscationLevel::Low: return {1.1, 1.5};
+    case ObfuscationLevel::Medium: return {1.5, 2.5};
+    case ObfuscationLevel::High: return {2.5, 4.0};
+    case ObfuscationLevel::Aggressive: return {5.0, 8.0};
+    case ObfuscationLevel::Insane: return {0, 0};
+    }
+    return {1.0, 1.0};
+}
+
+void applyLevel(ObfuscationOptions &Opts, ObfuscationLevel Level) {
+    Opts.Level = Level;
+    Opts.EnableStr = Level >= ObfuscationLevel::Low;
+    Opts.EnableSub = Level >= ObfuscationLevel::Low;
+    Opts.EnableInd = Level >= ObfuscationLevel::Medium;
+    Opts.EnableBcf = Level >= ObfuscationLevel::Medium;
+    Opts.EnableFla = Level >= ObfuscationLevel::High;
+
+    switch (Level) {
+    case ObfuscationLevel::None:
+        break;
+    case ObfuscationLevel::Low:
+        Opts.SubProb = 30;
+        break;
+    case ObfuscationLevel::Medium:
+        Opts.SubProb = 50;
+        Opts.BcfProb = 30;
+        break;
+    case ObfuscationLevel::High:
+        Opts.SubProb = 70;
+        Opts.BcfProb = 50;
+        break;
+    case ObfuscationLevel::Aggressive:
+        Opts.SubProb = 80;
+        Opts.BcfProb = 70;
+        Opts.BcfLoop = 2;
+        break;
+    case ObfuscationLevel::Insane:
+        Opts.SubProb = 100;
+        Opts.BcfProb = 100;
+        Opts.BcfLoop = 3;
+        break;
+    }
+}
+
+Error loadPreset(StringRef Path, ObfuscationOptions &Opts) {
+    auto Buf = MemoryBuffer::getFile(Path);
+    if (!Buf) return errorCodeToError(Buf.getError());
+    if (Error E = parsePreset((*Buf)->getBuffer(), Opts)) {
+        return createStringError(inconvertibleErrorCode(), "%s: %s", Path.str().c_str(),
+                                 toString(std::move(E)).c_str());
+    }
+    return Error::success();
+}
+
+Error parsePreset(StringRef Buffer, ObfuscationOptions &Opts) {
+    Expected<json::Value> Parsed = json::parse(Buffer);
+    if (!Parsed) return Parsed.takeError();
+
+    const json::Object *Root = Parsed->getAsObject();
+    const json::Object *O = Root ? Root->getObject("options") : nullptr;
+    if (!O) return createStringError(inconvertibleErrorCode(), "missing \"options\" object");
+
+    auto readBool = [&](StringRef Key, bool &Out) {
+        if (auto V = O->getBoolean(Key)) Out = *V;
+    };
+    auto readInt = [&](StringRef Key, int &Out) {
+        if (auto V = O->getInteger(Key)) Out = static_cast<int>(*V);
+    };
+    readBool("str", Opts.EnableStr);
+    readBool("sub", Opts.EnableSub);
+    readBool("ind", Opts.EnableInd);
+    readBool("bcf", Opts.EnableBcf);
+    readBool("fla", Opts.EnableFla);
+    readInt("fla_split", Opts.FlaSplitNum);
+    readInt("bcf_prob", Opts.BcfProb);
+    readInt("bcf_loop", Opts.BcfLoop);
+    readInt("sub_prob", Opts.SubProb);
+    readInt("opt_level", Opts.OptLevel);
+    readBool("instrument", Opts.Instrument);
+    readBool("outline", Opts.Outline);
+    readBool("reg_pressure", Opts.RegPressure);
+    if (auto V = O->getInteger("fn_time_limit_ms")) Opts.FnTimeLimitMs = static_cast<unsigned>(*V);
+    if (auto V = O->getNumber("fn_growth_limit")) Opts.FnGrowthLimit = *V;
+
+    if (const json::Object *P = O->getObject("placement")) {
+        auto readPlacement = [&](StringRef Key, PipelinePlacement &Out) {
+            if (auto V = P->getString(Key)) parsePlacementName(*V, Out);
+        };
+        readPlacement("str", Opts.StrPlacement);
+        readPlacement("ind", Opts.IndPlacement);
+        readPlacement("sub", Opts.SubPlacement);
+        readPlacement("bcf", Opts.BcfPlacement);
+        readPlacement("fla", Opts.FlaPlacement);
+    }
+    return Error::success();
+}
+
+static void writeOptionsObject(json::OStream &J, const ObfuscationOptions &Opts) {
+    J.attributeObject("options", [&] {
+        J.attribute("str", Opts.EnableStr);
+        J.attribute("sub", Opts.EnableSub);
+        J.attribute("ind", Opts.EnableInd);
+        J.attribute("bcf", Opts.EnableBcf);
+        J.attribute("fla", Opts.EnableFla);
+        J.attribute("fla_split", Opts.FlaSplitNum);
+        J.attribute("bcf_prob", Opts.BcfProb);
+        J.attribute("bcf_loop", Opts.BcfLoop);
+        J.attribute("sub_prob", Opts.SubProb);
+        J.attribute("opt_level", Opts.OptLevel);
+        J.attribute("instrument", Opts.Instrument);
+        J.attribute("outline", Opts.Outline);
+        J.attribute("reg_pressure", Opts.RegPressure);
+        J.attribute("fn_time_limit_ms", static_cast<int64_t>(Opts.FnTimeLimitMs));
+        J.attribute("fn_growth_limit", Opts.FnGrowthLimit);
+        J.attributeObject("placement", [&] {
+            J.attribute("str", getPlacementName(Opts.StrPlacement));
+            J.attribute("ind", getPlacementName(Opts.IndPlacement));
+            J.attribute("sub", getPlacementName(Opts.SubPlacement));
+            J.attribute("bcf", getPlacementName(Opts.BcfPlacement));
+            J.attribute("fla", getPlacementName(Opts.FlaPlacement));
+        });
+    });
+}
+
+void writeOptions(raw_ostream &OS, const ObfuscationOptions &Opts) {
+    json::OStream J(OS);
+    J.object([&] { writeOptionsObject(J, Opts); });
+}
+
+void writePreset(raw_ostream &OS, const ObfuscationOptions &Opts,
+                 const TuningResult &Result) {
+    OverheadBudget Budget = getOverheadBudget(Opts.Level);
+    json::OStream J(OS, 2);
+    J.object([&] {
+        J.attribute("level", getLevelName(Opts.Level));
+        J.attribute("max_runtime_overhead", Budget.MaxRuntime);
+        J.attribute("max_code_size_overhead", Budget.MaxSize);
+        J.attribute("runtime_overhead", Result.RuntimeOverhead);
+        J.attribute("code_size_overhead", Result.SizeOverhead);
+        J.attribute("score", Result.Score);
+        writeOptionsObject(J, Opts);
+    });
+    OS << "\n";
+}
+
+}  
@@ -0,0 +1,164 @@
+#include "Obfuscation/RegisterPressure.h"
+#include "llvm/ADT/BitVector.h"
+#include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include <algorithm>
+#include <vector>
+
+using namespace llvm;
+
+namespace obfuscator {
+
+static bool isRegisterValue(const Value *V) {
+    if (V->getType()->isVoidTy() || V->getType()->isTokenTy() || V->getType()->isLabelTy() ||
+        V->getType()->isMetadataTy()) {
+        return false;
+    }
+    if (const auto *AI = dyn_cast<AllocaInst>(V)) return !AI->isStaticAlloca();
+    return isa<Instruction>(V) || isa<Argument>(V);
+}
+
+// Live sets are bit vectors over the function's values, two per block.
+// Functions that would need more bits than this are left unconstrained.
+static const uint64_t MaxLivenessBits = uint64_t(1) << 26;
+
+RegisterPressure::RegisterPressure(Function &F, const TargetTransformInfo &TTI) : TTI(TTI) {
+    unsigned NumInstrs = F.getInstructionCount();
+    DenseMap<const Value *, unsigned> Ids(F.arg_size() + NumInstrs);
+    std::vector<unsigned> ClassOf;
+    auto number = [&](Value *V) {
+        if (!isRegisterValue(V)) return;
+        Ids[V] = ClassOf.size();
+        ClassOf.push_back(getClass(V->getType()));
+    };
+    for (Argument &A : F.args()) number(&A);
+    for (Instruction &I : instructions(F)) number(&I);
+    if (ClassOf.empty() || uint64_t(ClassOf.size()) * F.size() > MaxLivenessBits) return;
+
+    unsigned NumValues = ClassOf.size();
+    unsigned NumClasses = *std::max_element(ClassOf.begin(), ClassOf.end()) + 1;
+    std::vector<BitVector> Masks(NumClasses, BitVector(NumValues));
+    for (unsigned V = 0; V < NumValues; ++V) Masks[ClassOf[V]].set(V);
+
+    DenseMap<const BasicBlock *, unsigned> Index(F.size());
+    for (BasicBlock &BB : F) {
+        unsigned N = Index.size();
+        Index[&BB] = N;
+    }
+    std::vector<SmallVector<unsigned, 2>> Succs(Index.size());
+    for (BasicBlock &BB : F) {
+        for (BasicBlock *Succ : successors(&BB)) Succs[Index.lookup(&BB)].push_back(Index.lookup(Succ));
+    }
+
+    // Upward-exposed uses are the operands not defined in the block (in SSA
+    // a definition precedes its uses, except through PHIs). PHI operands are
+    // live out of the incoming block instead.
+    std::vector<BitVector> Gen(Index.size(), BitVector(NumValues));
+    std::vector<BitVector> Kill(Index.size(), BitVector(NumValues));
+    std::vector<SmallVector<unsigned, 4>> PhiUses(Index.size());
+    for (BasicBlock &BB : F) {
+        unsigned B = Index.lookup(&BB);
+        for (Instruction &I : BB) {
+            auto Def = Ids.find(&I);
+            if (Def != Ids.end()) Kill[B].set(Def->second);
+            auto *PN = dyn_cast<PHINode>(&I);
+            for (Use &U : I.operands()) {
+                auto Op = Ids.find(U.get());
+                if (Op == Ids.end()) continue;
+                if (PN) PhiUses[Index.lookup(PN->getIncomingBlock(U))].push_back(Op->second);
+                else Gen[B].set(Op->second);
+            }
+        }
+        Gen[B].reset(Kill[B]);
+    }
+
+    std::vector<BitVector> LiveIn(Index.size(), BitVector(NumValues));
+    std::vector<BitVector> LiveOut(Index.size(), BitVector(NumValues));
+    BitVector In(NumValues);
+    std::vector<BasicBlock *> Order(po_begin(&F.getEntryBlock()), po_end(&F.getEntryBlock()));
+    std::vector<unsigned> OrderIndex;
+    for (BasicBlock *BB : Order) OrderIndex.push_back(Index.lookup(BB));
+    for (bool Changed = true; Changed;) {
+        Changed = false;
+        for (unsigned B : OrderIndex) {
+            BitVector &Out = LiveOut[B];
+            for (unsigned S : Succs[B]) Out |= LiveIn[S];
+            for (unsigned V : PhiUses[B]) Out.set(V);
+            In = Out;
+            In.reset(Kill[B]);
+            In |= Gen[B];
+            if (In != LiveIn[B]) {
+                LiveIn[B] = In;
+                Changed = true;
+            }
+        }
+    }
+
+    EntryLive.reserve(Order.size());
+    LiveBefore.reserve(NumInstrs);
+    for (BasicBlock *BB : Order) {
+        BitVector Live = LiveOut[Index.lookup(BB)];
+        SmallVector<unsigned, 2> Count(NumClasses);
+        for (unsigned C = 0; C < NumClasses; ++C) {
+            BitVector InClass = Live;
+            InClass &= Masks[C];
+            Count[C] = InClass.count();
+        }
+        for (Instruction &I : reverse(*BB)) {
+            if (isa<PHINode>(I)) break;
+            auto Def = Ids.find(&I);
+            if (Def != Ids.end() && Live.test(Def->second)) {
+                Live.reset(Def->second);
+                Count[ClassOf[Def->second]]--;
+            }
+            for (Value *Op : I.operands()) {
+                auto It = Ids.find(Op);
+                if (It == Ids.end() || Live.test(It->second)) continue;
+                Live.set(It->second);
+                Count[ClassOf[It->second]]++;
+            }
+            if (Def != Ids.end()) LiveBefore[&I] = Count[ClassOf[Def->second]];
+        }
+        EntryLive[BB] = std::move(Count);
+    }
+}
+
+unsigned RegisterPressure::getClass(Type *Ty) const {
+    auto It = Classes.find(Ty);
+    if (It != Classes.end()) return It->second;
+    unsigned C = TTI.getRegisterClassForType(Ty->isVectorTy(), Ty);
+    Classes[Ty] = C;
+    return C;
+}
+
+bool RegisterPressure::exceeds(unsigned Class, unsigned Live, unsigned Extra) const {
+    return Live + Extra > TTI.getNumberOfRegisters(Class);
+}
+
+static unsigned countIn(const DenseMap<const BasicBlock *, SmallVector<unsigned, 2>> &Counts,
+                        const BasicBlock &BB, unsigned C) {
+    auto It = Counts.find(&BB);
+    return It != Counts.end() && C < It->second.size() ? It->second[C] : 0;
+}
+
+bool RegisterPressure::exceedsAtEntry(const BasicBlock &BB, Type *Ty, unsigned Extra) const {
+    unsigned C = getClass(Ty);
+    return exceeds(C, countIn(EntryLive, BB, C) + countIn(Added, BB, C), Extra);
+}
+
+bool RegisterPressure::exceedsAt(const Instruction &I, unsigned Extra) const {
+    unsigned C = getClass(I.getType());
+    return exceeds(C, LiveBefore.lookup(&I) + countIn(Added, *I.getParent(), C), Extra);
+}
+
+void RegisterPressure::addLive(const BasicBlock &BB, Type *Ty, unsigned N) {
+    unsigned C = getClass(Ty);
+    SmallVector<unsigned, 2> &Counts = Added[&BB];
+    if (Counts.size() <= C) Counts.resize(C + 1);
+    Counts[C] += N;
+}
+
+}  
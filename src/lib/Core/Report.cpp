@@ -0,0 +1,100 @@
+#include "Obfuscation/Report.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/JSON.h"
+
+using namespace llvm;
+
+namespace obfuscator {
+
+void writeStatsReport(raw_ostream &OS, const ObfuscationStats &Stats, uint64_t Seed) {
+    OS << "{\n";
+    OS << "  \"seed\": \"" << Seed << "\",\n";
+    OS << "  \"obfuscation_metrics\": {\n";
+    OS << "    \"flattened_functions\": " << Stats.FlattenedFunctions << ",\n";
+    OS << "    \"dispatch_regions\": " << Stats.DispatchRegions << ",\n";
+    OS << "    \"bogus_blocks\": " << Stats.BogusBlocks << ",\n";
+    OS << "    \"opaque_predicates\": " << Stats.OpaquePredicates << ",\n";
+    OS << "    \"encrypted_strings\": " << Stats.EncryptedStrings << ",\n";
+    OS << "    \"string_dirty_pages\": " << Stats.StringPages << ",\n";
+    OS << "    \"substituted_instructions\": " << Stats.SubstitutedInstrs << ",\n";
+    OS << "    \"indirect_calls\": " << Stats.IndirectCalls << ",\n";
+    OS << "    \"watchdog_fallbacks\": " << Stats.WatchdogFallbacks << ",\n";
+    OS << "    \"bcf_pressure_skips\": " << Stats.BcfPressureSkips << ",\n";
+    OS << "    \"sub_pressure_skips\": " << Stats.SubPressureSkips << "\n";
+    OS << "  }\n";
+    OS << "}\n";
+}
+
+void PhaseTimer::end(StringRef Phase) {
+    auto Now = std::chrono::steady_clock::now();
+    Phases.push_back({Phase, Now - Last});
+    Last = Now;
+}
+
+void PhaseTimer::print(raw_ostream &OS) const {
+    auto toMs = [](std::chrono::steady_clock::duration D) {
+        return std::chrono::duration<double, std::milli>(D).count();
+    };
+    OS << "phase         time (ms)\n";
+    for (const auto &P : Phases) {
+        OS << left_justify(P.first, 12) << format(" %10.3f\n", toMs(P.second));
+    }
+    OS << left_justify("total", 12) << format(" %10.3f\n", toMs(Last - Start));
+}
+
+void FunctionReport::begin(const Function &F) {
+    Applied.clear();
+    Skipped.clear();
+    FallbackTier = FallbackReason = StringRef();
+    OrgBlocks = F.size();
+    OrgInstrs = F.getInstructionCount();
+    Start = std::chrono::steady_clock::now();
+}
+
+void FunctionReport::applied(StringRef Pass) {
+    Applied.push_back(Pass);
+}
+
+void FunctionReport::skipped(StringRef Pass, StringRef Reason) {
+    Skipped.push_back({Pass, Reason});
+}
+
+void FunctionReport::fallback(StringRef Tier, StringRef Reason) {
+    Applied.clear();
+    Skipped.clear();
+    FallbackTier = Tier;
+    FallbackReason = Reason;
+}
+
+void FunctionReport::end(const Function &F) {
+    auto Elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - Start);
+
+    json::OStream J(OS);
+    J.object([&] {
+        J.attribute("function", F.getName());
+        J.attributeArray("passes", [&] {
+            for (StringRef P : Applied) J.value(P);
+        });
+        J.attributeArray("skipped", [&] {
+            for (auto &S : Skipped) {
+                J.object([&] {
+                    J.attribute("pass", S.first);
+                    J.attribute("reason", S.second);
+                });
+            }
+        });
+        if (!FallbackTier.empty()) {
+            J.attribute("fallback", FallbackTier);
+            J.attribute("fallback_reason", FallbackReason);
+        }
+        J.attribute("blocks_before", static_cast<int64_t>(OrgBlocks));
+        J.attribute("blocks_after", static_cast<int64_t>(F.size()));
+        J.attribute("instrs_before", static_cast<int64_t>(OrgInstrs));
+        J.attribute("instrs_after", static_cast<int64_t>(F.getInstructionCount()));
+        J.attribute("time_us", static_cast<int64_t>(Elapsed.count()));
+    });
+    OS << '\n';
+}
+
+}
@@ -0,0 +1,233 @@
+#include "Obfuscation/Server.h"
+#include "Obfuscation/Engine.h"
+#include "Obfuscation/Presets.h"
+#include "Obfuscation/Report.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/raw_ostream.h"
+
+#ifndef _WIN32
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+using namespace llvm;
+
+namespace obfuscator {
+
+#ifndef _WIN32
+
+static const char RequestMagic[4] = {'O', 'B', 'F', '1'};
+static const uint64_t MaxPayload = 1ULL << 32;
+static const uint32_t MaxOptionsBytes = 1 << 20;
+
+static bool writeAll(int FD, const void *Data, size_t Len) {
+    const char *P = static_cast<const char *>(Data);
+    while (Len) {
+        ssize_t N = ::write(FD, P, Len);
+        if (N < 0 && errno == EINTR) continue;
+        if (N <= 0) return false;
+        P += N;
+        Len -= N;
+    }
+    return true;
+}
+
+static bool readAll(int FD, void *Data, size_t Len) {
+    char *P = static_cast<char *>(Data);
+    while (Len) {
+        ssize_t N = ::read(FD, P, Len);
+        if (N < 0 && errno == EINTR) continue;
+        if (N <= 0) return false;
+        P += N;
+        Len -= N;
+    }
+    return true;
+}
+
+template <typename T> static bool writeInt(int FD, T V) {
+    unsigned char Buf[sizeof(T)];
+    for (size_t i = 0; i < sizeof(T); ++i) Buf[i] = static_cast<unsigned char>(V >> (8 * i));
+    return writeAll(FD, Buf, sizeof(T));
+}
+
+template <typename T> static bool readInt(int FD, T &V) {
+    unsigned char Buf[sizeof(T)];
+    if (!readAll(FD, Buf, sizeof(T))) return false;
+    V = 0;
+    for (size_t i = 0; i < sizeof(T); ++i) V |= static_cast<T>(Buf[i]) << (8 * i);
+    return true;
+}
+
+template <typename LenT> static bool writeBlob(int FD, StringRef Data) {
+    return writeInt<LenT>(FD, Data.size()) && writeAll(FD, Data.data(), Data.size());
+}
+
+template <typename LenT> static bool readBlob(int FD, std::string &Data, uint64_t Max = MaxPayload) {
+    LenT Len;
+    if (!readInt<LenT>(FD, Len) || Len > Max) return false;
+    Data.resize(Len);
+    return readAll(FD, &Data[0], Len);
+}
+
+static bool sendResponse(int FD, uint32_t Status, StringRef Message, StringRef Bitcode) {
+    return writeInt<uint32_t>(FD, Status) && writeBlob<uint32_t>(FD, Message) &&
+           writeBlob<uint64_t>(FD, Bitcode);
+}
+
+static void handleConnection(int FD, const ServerOptions &SO) {
+    char Magic[4];
+    uint64_t Seed;
+    std::string OptionsJSON, Input;
+    if (!readAll(FD, Magic, 4) || memcmp(Magic, RequestMagic, 4) != 0 ||
+        !readInt<uint64_t>(FD, Seed) || !readBlob<uint32_t>(FD, OptionsJSON, MaxOptionsBytes) ||
+        !readBlob<uint64_t>(FD, Input, SO.MaxInputBytes)) {
+        sendResponse(FD, 1, "malformed, oversized or timed-out request", "");
+        ::close(FD);
+        return;
+    }
+
+    ObfuscationOptions Opts;
+    if (Error E = parsePreset(OptionsJSON, Opts)) {
+        sendResponse(FD, 1, toString(std::move(E)), "");
+        ::close(FD);
+        return;
+    }
+    Opts.Seed = Seed;
+
+    LLVMContext Context;
+    SMDiagnostic Err;
+    std::unique_ptr<Module> M =
+        parseIR(MemoryBufferRef(Input, "<request>"), Err, Context);
+    if (!M) {
+        std::string Msg;
+        raw_string_ostream MsgOS(Msg);
+        Err.print("obfuscator", MsgOS);
+        sendResponse(FD, 1, MsgOS.str(), "");
+        ::close(FD);
+        return;
+    }
+
+    ObfuscationStats Stats;
+    Opts.Stats = &Stats;
+    ObfuscationEngine(Opts).run(*M);
+
+    std::string Msg;
+    raw_string_ostream MsgOS(Msg);
+    if (verifyModule(*M, &MsgOS)) {
+        sendResponse(FD, 1, "module verification failed after obfuscation:\n" + MsgOS.str(), "");
+        ::close(FD);
+        return;
+    }
+
+    writeStatsReport(MsgOS, Stats, Opts.Seed);
+    SmallVector<char, 0> Bitcode;
+    raw_svector_ostream BCOS(Bitcode);
+    WriteBitcodeToFile(*M, BCOS);
+
+    sendResponse(FD, 0, MsgOS.str(), StringRef(Bitcode.data(), Bitcode.size()));
+    ::close(FD);
+}
+
+static Expected<sockaddr_un> makeAddress(StringRef Path) {
+    sockaddr_un Addr = {};
+    Addr.sun_family = AF_UNIX;
+    if (Path.size() >= sizeof(Addr.sun_path)) {
+        return createStringError(inconvertibleErrorCode(), "socket path too long: %s", Path.str().c_str());
+    }
+    memcpy(Addr.sun_path, Path.data(), Path.size());
+    return Addr;
+}
+
+Error runServer(const ServerOptions &SO) {
+    Expected<sockaddr_un> Addr = makeAddress(SO.SocketPath);
+    if (!Addr) return Addr.takeError();
+
+    int Listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (Listener < 0) return errorCodeToError(std::error_code(errno, std::generic_category()));
+
+    ::unlink(SO.SocketPath.c_str());
+    if (::bind(Listener, reinterpret_cast<sockaddr *>(&*Addr), sizeof(*Addr)) < 0 ||
+        ::listen(Listener, SOMAXCONN) < 0) {
+        std::error_code EC(errno, std::generic_category());
+        ::close(Listener);
+        return errorCodeToError(EC);
+    }
+
+    ::signal(SIGPIPE, SIG_IGN);
+    ThreadPool Pool(hardware_concurrency(SO.Threads));
+
+    while (true) {
+        int FD = ::accept(Listener, nullptr, nullptr);
+        if (FD < 0) {
+            if (errno == EINTR) continue;
+            std::error_code EC(errno, std::generic_category());
+            Pool.wait();
+            ::close(Listener);
+            return errorCodeToError(EC);
+        }
+        if (SO.ReadTimeoutSec) {
+            timeval Timeout = {};
+            Timeout.tv_sec = SO.ReadTimeoutSec;
+            ::setsockopt(FD, SOL_SOCKET, SO_RCVTIMEO, &Timeout, sizeof(Timeout));
+            ::setsockopt(FD, SOL_SOCKET, SO_SNDTIMEO, &Timeout, sizeof(Timeout));
+        }
+        Pool.async([FD, &SO] { handleConnection(FD, SO); });
+    }
+}
+
+Expected<RemoteResult> obfuscateRemote(StringRef SocketPath, StringRef Input,
+                                       const ObfuscationOptions &Opts) {
+    Expected<sockaddr_un> Addr = makeAddress(SocketPath);
+    if (!Addr) return Addr.takeError();
+
+    int FD = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (FD < 0) return errorCodeToError(std::error_code(errno, std::generic_category()));
+    if (::connect(FD, reinterpret_cast<sockaddr *>(&*Addr), sizeof(*Addr)) < 0) {
+        std::error_code EC(errno, std::generic_category());
+        ::close(FD);
+        return errorCodeToError(EC);
+    }
+
+    std::string OptionsJSON;
+    raw_string_ostream OptionsOS(OptionsJSON);
+    writeOptions(OptionsOS, Opts);
+
+    uint32_t Status;
+    RemoteResult Result;
+    bool OK = writeAll(FD, RequestMagic, 4) && writeInt<uint64_t>(FD, Opts.Seed) &&
+              writeBlob<uint32_t>(FD, OptionsOS.str()) && writeBlob<uint64_t>(FD, Input) &&
+              readInt<uint32_t>(FD, Status) && readBlob<uint32_t>(FD, Result.Report) &&
+              readBlob<uint64_t>(FD, Result.Bitcode);
+    ::close(FD);
+
+    if (!OK) return createStringError(inconvertibleErrorCode(), "lost connection to obfuscation server");
+    if (Status != 0) return createStringError(inconvertibleErrorCode(), Result.Report);
+    return Result;
+}
+
+#else
+
+Error runServer(const ServerOptions &SO) {
+    return createStringError(inconvertibleErrorCode(), "server mode is not supported on this platform");
+}
+
+Expected<RemoteResult> obfuscateRemote(StringRef SocketPath, StringRef Input,
+                                       const ObfuscationOptions &Opts) {
+    return createStringError(inconvertibleErrorCode(), "server mode is not supported on this platform");
+}
+
+#endif
+
+}  
@@ -0,0 +1,131 @@
+#include "Obfuscation/Variants.h"
+#include "Obfuscation/Engine.h"
+#include "Obfuscation/Layout.h"
+#include "Obfuscation/Utils.h"
+#include "Obfuscation/Verification.h"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include <algorithm>
+#include <atomic>
+#include <optional>
+#include <ctime>
+
+using namespace llvm;
+
+namespace obfuscator {
+
+std::string getVariantPath(StringRef Pattern, unsigned Index) {
+    std::string Path = Pattern.str();
+    size_t Pos = Path.find("{}");
+    if (Pos != std::string::npos) {
+        Path.replace(Pos, 2, std::to_string(Index));
+        return Path;
+    }
+    StringRef Ext = sys::path::extension(Pattern);
+    return (Pattern.drop_back(Ext.size()) + "." + Twine(Index) + Ext).str();
+}
+
+static Error writeVariant(Module &M, const std::string &Path, const VariantOptions &VO) {
+    if (VO.EmitObject) return emitObjectFile(M, Path, VO.ObjectOptions);
+
+    std::error_code EC;
+    raw_fd_ostream OS(Path, EC, sys::fs::OF_None);
+    if (EC) return errorCodeToError(EC);
+    WriteBitcodeToFile(M, OS);
+    return Error::success();
+}
+
+std::vector<VariantResult> buildVariants(const Module &M, const ObfuscationOptions &Opts,
+                                         const VariantOptions &VO) {
+    SmallVector<char, 0> Bitcode;
+    raw_svector_ostream BCOS(Bitcode);
+    WriteBitcodeToFile(M, BCOS);
+    MemoryBufferRef Buffer(StringRef(Bitcode.data(), Bitcode.size()), M.getModuleIdentifier());
+
+    uint64_t BaseSeed = Opts.Seed ? Opts.Seed : Utils::randomSeed();
+    std::vector<VariantResult> Results(VO.Count);
+    std::atomic<unsigned> Next(0);
+
+    unsigned Workers = std::min(VO.Count, hardware_concurrency(VO.Threads).compute_thread_count());
+    ThreadPool Pool(hardware_concurrency(Workers));
+    for (unsigned w = 0; w < Workers; ++w) {
+        Pool.async([&] {
+            LLVMContext Context;
+            Expected<std::unique_ptr<Module>> Base = parseBitcodeFile(Buffer, Context);
+            std::string BaseError = Base ? std::string() : toString(Base.takeError());
+
+            for (unsigned i = Next++; i < VO.Count; i = Next++) {
+                VariantResult &R = Results[i];
+                R.Index = i;
+                R.Seed = Utils::deriveSeed(BaseSeed, i);
+                R.Path = getVariantPath(VO.OutputPattern, i);
+                if (!BaseError.empty()) {
+                    R.Error = BaseError;
+                    continue;
+                }
+
+                std::unique_ptr<Module> Variant = CloneModule(**Base);
+                FunctionVerifier Verifier(VO.Verify, VO.VerifySample, 1, VO.VerifyModule);
+                ObfuscationOptions VariantOpts = Opts;
+                VariantOpts.Seed = R.Seed;
+                VariantOpts.Stats = &R.Stats;
+                VariantOpts.FnReport = nullptr;
+                VariantOpts.Verifier = &Verifier;
+                std::optional<FunctionLayout> Layout;
+                if (Opts.Layout) {
+                    Layout.emplace(Opts.Layout->hasSectionHints());
+                    VariantOpts.Layout = &*Layout;
+                }
+
+                ObfuscationEngine(VariantOpts).run(*Variant);
+
+                if (Error E = Verifier.finish(*Variant)) {
+                    R.Error = toString(std::move(E));
+                } else if (Error E = writeVariant(*Variant, R.Path, VO)) {
+                    R.Error = toString(std::move(E));
+                }
+            }
+        });
+    }
+    Pool.wait();
+    return Results;
+}
+
+void writeVariantsReport(raw_ostream &OS, ArrayRef<VariantResult> Results) {
+    json::OStream J(OS, 2);
+    J.object([&] {
+        J.attributeArray("variants", [&] {
+            for (const VariantResult &R : Results) {
+                J.object([&] {
+                    J.attribute("index", R.Index);
+                    J.attribute("seed", std::to_string(R.Seed));
+                    J.attribute("output", R.Path);
+                    if (!R.Error.empty()) J.attribute("error", R.Error);
+                    J.attributeObject("obfuscation_metrics", [&] {
+                        J.attribute("flattened_functions", R.Stats.FlattenedFunctions);
+                        J.attribute("dispatch_regions", R.Stats.DispatchRegions);
+                        J.attribute("bogus_blocks", R.Stats.BogusBlocks);
+                        J.attribute("opaque_predicates", R.Stats.OpaquePredicates);
+                        J.attribute("encrypted_strings", R.Stats.EncryptedStrings);
+                        J.attribute("string_dirty_pages", R.Stats.StringPages);
+                        J.attribute("substituted_instructions", R.Stats.SubstitutedInstrs);
+                        J.attribute("indirect_calls", R.Stats.IndirectCalls);
+                        J.attribute("watchdog_fallbacks", R.Stats.WatchdogFallbacks);
+                        J.attribute("bcf_pressure_skips", R.Stats.BcfPressureSkips);
+                        J.attribute("sub_pressure_skips", R.Stats.SubPressureSkips);
+                    });
+                });
+            }
+        });
+    });
+    OS << "\n";
+}
+
+}  
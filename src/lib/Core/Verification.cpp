@@ -0,0 +1,169 @@
+#include "Obfuscation/Verification.h"
+#include "llvm/ADT/Any.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/Verifier.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/xxhash.h"
+
+using namespace llvm;
+
+namespace obfuscator {
+
+static StringRef getShortPassName(StringRef PassID) {
+    PassID.consume_front("obfuscator::");
+    if (PassID == "SubstitutionPass") return "sub";
+    if (PassID == "BogusControlFlowPass") return "bcf";
+    if (PassID == "FlatteningPass") return "fla";
+    if (PassID == "StringEncryptionPass") return "str";
+    if (PassID == "IndirectCallPass") return "ind";
+    if (PassID == "FunctionWatchdogPass") return "watchdog";
+    return "";
+}
+
+FunctionVerifier::FunctionVerifier(VerifyMode Mode, unsigned SampleRate, unsigned Threads, bool FullModule)
+    : Mode(Mode), SampleRate(SampleRate ? SampleRate : 1), FullModule(FullModule),
+      Pool(hardware_concurrency(Threads)) {}
+
+void FunctionVerifier::registerCallbacks(PassInstrumentationCallbacks &PIC) {
+    if (Mode == VerifyMode::Off) return;
+
+    // Function and loop passes cannot add or delete functions, so queued
+    // functions stay valid until the next module or CGSCC pass. Broken IR
+    // must not reach another optional pass; required ones (pass managers
+    // and adaptors) still run, but their optional passes are skipped.
+    auto isBarrier = [](const Any &IR) {
+        return !any_cast<const Function *>(&IR) && !any_cast<const Loop *>(&IR);
+    };
+    PIC.registerShouldRunOptionalPassCallback([this, isBarrier](StringRef, Any IR) {
+        if (isBarrier(IR)) flush();
+        return Failures.empty();
+    });
+    PIC.registerBeforeNonSkippedPassCallback([this, isBarrier](StringRef, Any IR) {
+        if (isBarrier(IR)) flush();
+    });
+
+    PIC.registerAfterPassCallback([this](StringRef PassID, Any IR, const PreservedAnalyses &PA) {
+        StringRef Pass = getShortPassName(PassID);
+        if (Pass.empty() || PA.areAllPreserved()) return;
+        if (const auto *F = any_cast<const Function *>(&IR)) {
+            check(**F, Pass);
+        } else if (const auto *M = any_cast<const Module *>(&IR)) {
+            checkModule(**M, Pass);
+        }
+    });
+}
+
+void FunctionVerifier::check(const Function &F, StringRef Pass) {
+    if (Mode == VerifyMode::Off || F.isDeclaration()) return;
+    if (Mode == VerifyMode::Sampled && xxHash64(F.getName()) % SampleRate != 0) return;
+
+    std::vector<std::string> &Passes = Queue[&F];
+    if (!is_contained(Passes, Pass)) Passes.push_back(Pass.str());
+}
+
+void FunctionVerifier::checkModule(const Module &M, StringRef Pass) {
+    for (const Function &F : M) check(F, Pass);
+}
+
+void FunctionVerifier::flush() {
+    if (Queue.empty()) return;
+
+    // Each check writes only its own slot, and nothing changes the IR until
+    // the pool is done.
+    std::vector<std::string> Results(Queue.size());
+    for (size_t i = 0; i < Queue.size(); ++i) {
+        const Function *F = Queue.begin()[i].first;
+        Pool.async([F, &Results, i] {
+            raw_string_ostream OS(Results[i]);
+            verifyFunction(*F, &OS);
+        });
+    }
+    Pool.wait();
+
+    for (size_t i = 0; i < Queue.size(); ++i) {
+        if (Results[i].empty()) continue;
+        const auto &[F, Passes] = Queue.begin()[i];
+        Failures.push_back("function '" + F->getName().str() + "' is broken after " +
+                           (Passes.size() == 1 ? "pass '" : "one of the passes '") + join(Passes, "', '") +
+                           "':\n" + Results[i]);
+    }
+    Queue.clear();
+}
+
+static void checkUsedList(const Module &M, StringRef Name, raw_ostream &OS) {
+    const GlobalVariable *GV = M.getNamedGlobal(Name);
+    if (!GV || !GV->hasInitializer()) return;
+    const auto *Init = dyn_cast<ConstantArray>(GV->getInitializer());
+    if (!Init) {
+        if (!isa<ConstantAggregateZero>(GV->getInitializer())) OS << Name << " is not an array\n";
+        return;
+    }
+    for (const Use &U : Init->operands()) {
+        const auto *Used = dyn_cast<GlobalValue>(U->stripPointerCasts());
+        if (!Used || !Used->hasName()) OS << Name << " lists something other than a named global\n";
+    }
+}
+
+static void checkStructors(const Module &M, StringRef Name, raw_ostream &OS) {
+    const GlobalVariable *GV = M.getNamedGlobal(Name);
+    if (!GV || !GV->hasInitializer()) return;
+    if (!GV->hasAppendingLinkage()) OS << Name << " does not have appending linkage\n";
+    const auto *Init = dyn_cast<ConstantArray>(GV->getInitializer());
+    if (!Init) return;
+    for (const Use &U : Init->operands()) {
+        const auto *Entry = dyn_cast<ConstantStruct>(U.get());
+        if (!Entry || Entry->getNumOperands() != 3 || !isa<ConstantInt>(Entry->getOperand(0)) ||
+            !isa<Function>(Entry->getOperand(1)->stripPointerCasts())) {
+            OS << Name << " has an entry that is not { i32, ptr to function, ptr }\n";
+        }
+    }
+}
+
+// The checks verifyModule makes outside function bodies, for what the
+// obfuscation passes add to a module: globals and their initializers, the
+// constructor list and the used lists. Function bodies are covered by the
+// per-function checks.
+static void checkModuleLevel(const Module &M, raw_ostream &OS) {
+    for (const GlobalValue &GV : M.global_values()) {
+        if (GV.isDeclaration() && !GV.hasExternalLinkage() && !GV.hasExternalWeakLinkage()) {
+            OS << "declaration '" << GV.getName() << "' is not external\n";
+        }
+    }
+    for (const GlobalVariable &GV : M.globals()) {
+        if (!GV.hasInitializer()) continue;
+        if (GV.getInitializer()->getType() != GV.getValueType()) {
+            OS << "initializer of '" << GV.getName() << "' does not match its type\n";
+        }
+        if (GV.hasAppendingLinkage() && !GV.getValueType()->isArrayTy()) {
+            OS << "appending global '" << GV.getName() << "' is not an array\n";
+        }
+    }
+    checkStructors(M, "llvm.global_ctors", OS);
+    checkStructors(M, "llvm.global_dtors", OS);
+    checkUsedList(M, "llvm.used", OS);
+    checkUsedList(M, "llvm.compiler.used", OS);
+}
+
+Error FunctionVerifier::finish(const Module &M) {
+    if (Mode == VerifyMode::Off) return Error::success();
+    flush();
+
+    if (Failures.empty()) {
+        std::string Msg;
+        raw_string_ostream OS(Msg);
+        if (FullModule) verifyModule(M, &OS);
+        else checkModuleLevel(M, OS);
+        if (!OS.str().empty()) Failures.push_back("module is broken after obfuscation:\n" + OS.str());
+    }
+    if (Failures.empty()) return Error::success();
+
+    std::string Msg;
+    for (const std::string &F : Failures) Msg += F;
+    Failures.clear();
+    return createStringError(inconvertibleErrorCode(), Msg);
+}
+
+}  
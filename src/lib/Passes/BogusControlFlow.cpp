@@ -1,19 +1,34 @@
+#include "Obfuscation/Layout.h"
 #include "Obfuscation/Passes.h"
+#include "Obfuscation/Outlining.h"
+#include "Obfuscation/Policy.h"
+#include "Obfuscation/RegisterPressure.h"
 #include "Obfuscation/Utils.h"
+#include "Obfuscation/Instrumentation.h"
+#include "Obfuscation/Report.h"
+#include "llvm/Analysis/DomTreeUpdater.h"
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/PostDominators.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
 #include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Dominators.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include <optional>
 #include <vector>
 
 using namespace llvm;
 
 namespace obfuscator {
 
+// The opaque predicate holds x and x + 1 at once.
+static const unsigned OpaquePredicateRegs = 2;
+
  
  
-Value* createOpaquePredicate(IRBuilder<> &Builder, Module *M) {
+Value* createOpaquePredicate(IRBuilder<> &Builder, Module *M, uint64_t Seed) {
     LLVMContext &Ctx = M->getContext();
     
      
@@ -21,7 +36,7 @@ Value* createOpaquePredicate(IRBuilder<> &Builder, Module *M) {
     if (!GX) {
         GX = new GlobalVariable(*M, Type::getInt32Ty(Ctx), false, 
             GlobalValue::PrivateLinkage, 
-            ConstantInt::get(Type::getInt32Ty(Ctx), Utils::randomRange(1, 100)), 
+            ConstantInt::get(Type::getInt32Ty(Ctx), RandomStream(Seed, "bcf", "opaque_x").range(1, 100)), 
             "opaque_x");
     }
     
@@ -58,21 +73,25 @@ Instruction* findSplitPoint(BasicBlock *BB) {
     return nullptr;
 }
 
-void addBogusFlow(BasicBlock *BB, Function &F, ObfuscationStats *Stats) {
+void addBogusFlow(BasicBlock *BB, Function &F, const ObfuscationOptions &Options, RandomStream &RNG,
+                  DomTreeUpdater &DTU, LoopInfo *LI) {
      
     Instruction *SplitPoint = findSplitPoint(BB);
     if (!SplitPoint) return;
     
      
-    BasicBlock *OriginalPart2 = BB->splitBasicBlock(SplitPoint, "real_path");
+    BasicBlock *OriginalPart2 = SplitBlock(BB, SplitPoint, &DTU, LI, nullptr, "real_path");
     
      
     BasicBlock *BogusBB = BasicBlock::Create(F.getContext(), "bogus_path", &F);
+    if (LI) {
+        if (Loop *L = LI->getLoopFor(BB)) L->addBasicBlockToLoop(BogusBB, *LI);
+    }
     
      
     IRBuilder<> JunkBuilder(BogusBB);
-    Value *X = ConstantInt::get(Type::getInt32Ty(F.getContext()), Utils::randomRange(1, 100));
-    Value *Y = ConstantInt::get(Type::getInt32Ty(F.getContext()), Utils::randomRange(1, 100));
+    Value *X = ConstantInt::get(Type::getInt32Ty(F.getContext()), RNG.range(1, 100));
+    Value *Y = ConstantInt::get(Type::getInt32Ty(F.getContext()), RNG.range(1, 100));
     JunkBuilder.CreateAdd(X, Y, "junk");
     JunkBuilder.CreateMul(X, Y, "junk2");
      
@@ -84,33 +103,54 @@ void addBogusFlow(BasicBlock *BB, Function &F, ObfuscationStats *Stats) {
     
      
     IRBuilder<> Builder(BB);
-    Value *Pred = createOpaquePredicate(Builder, F.getParent());
+    if (Options.Instrument) emitProfileIncrement(Builder, F, "opaque_predicate");
+    Value *Pred = Options.Outline ? emitOutlinedOpaquePredicate(Builder, *F.getParent(), RNG) : nullptr;
+    if (!Pred) Pred = createOpaquePredicate(Builder, F.getParent(), Options.Seed);
     
      
     Builder.CreateCondBr(Pred, OriginalPart2, BogusBB);
+    DTU.applyUpdates({{DominatorTree::Insert, BB, BogusBB},
+                      {DominatorTree::Insert, BogusBB, OriginalPart2}});
 
-    if (Stats) {
-        Stats->BogusBlocks++;
-        Stats->OpaquePredicates++;
+    if (Options.Stats) {
+        Options.Stats->BogusBlocks++;
+        Options.Stats->OpaquePredicates++;
     }
 }
 
-PreservedAnalyses BogusControlFlowPass::run(Module &M, ModuleAnalysisManager &AM) {
-    if (!Options.EnableBcf) return PreservedAnalyses::all();
+PreservedAnalyses BogusControlFlowPass::run(Function &F, FunctionAnalysisManager &AM) {
+    if (verificationFailed(Options)) return PreservedAnalyses::all();
+    PassPolicy Policy = getFunctionPolicy(Options, F);
+    if (!Policy.EnableBcf) {
+        if (Options.EnableBcf && Options.FnReport) Options.FnReport->skipped("bcf", Policy.Reason);
+        return PreservedAnalyses::all();
+    }
+
+    if (F.size() < 2) {
+        if (Options.FnReport) Options.FnReport->skipped("bcf", "too_few_blocks");
+        return PreservedAnalyses::all();
+    }
 
     bool Changed = false;
-    
-    for (Function &F : M) {
-        if (F.isDeclaration()) continue;
-        if (F.size() < 2) continue;  
-        
-         
-        if (F.getName().starts_with("decrypt_")) continue;
-        if (F.hasFnAttribute(Attribute::OptimizeNone)) continue;
+    RandomStream RNG(Options.Seed, "bcf", F.getName());
+    BasicBlock *EntryBB = &F.getEntryBlock();
+
+     
+    DomTreeUpdater DTU(AM.getCachedResult<DominatorTreeAnalysis>(F),
+                       AM.getCachedResult<PostDominatorTreeAnalysis>(F),
+                       DomTreeUpdater::UpdateStrategy::Lazy);
+    LoopInfo *LI = AM.getCachedResult<LoopAnalysis>(F);
+
+    const TargetTransformInfo *TTI = nullptr;
+    if (Options.RegPressure && hasTargetInfo(*F.getParent())) {
+        TTI = &AM.getResult<TargetIRAnalysis>(F);
+    }
+    Type *PredicateTy = Type::getInt32Ty(F.getContext());
+    int PressureSkips = 0;
 
+    for (int Loop = 0; Loop < Policy.BcfLoop && !pastDeadline(Options); ++Loop) {
          
         std::vector<BasicBlock*> Candidates;
-        BasicBlock *EntryBB = &F.getEntryBlock();
         
         for (BasicBlock &BB : F) {
              
@@ -125,16 +165,41 @@ PreservedAnalyses BogusControlFlowPass::run(Module &M, ModuleAnalysisManager &AM
             Candidates.push_back(&BB);
         }
 
-         
+        if (Candidates.empty()) {
+            if (Loop == 0 && Options.FnReport) Options.FnReport->skipped("bcf", "no_candidates");
+            break;
+        }
+
+        // Rebuilt every iteration, since the previous one split blocks.
+        std::optional<RegisterPressure> Pressure;
+        if (TTI) Pressure.emplace(F, *TTI);
+
         for (BasicBlock *BB : Candidates) {
-            if (Utils::roll(Options.BcfProb)) {
-                addBogusFlow(BB, F, Options.Stats);
-                Changed = true;
+            if (pastDeadline(Options)) break;
+            if (!RNG.roll(Policy.BcfProb)) continue;
+            if (Pressure && Pressure->exceedsAtEntry(*BB, PredicateTy, OpaquePredicateRegs)) {
+                PressureSkips++;
+                continue;
             }
+            addBogusFlow(BB, F, Options, RNG, DTU, LI);
+            Changed = true;
         }
     }
 
-    return Changed ? PreservedAnalyses::none() : PreservedAnalyses::all();
+    if (Options.Stats) Options.Stats->BcfPressureSkips += PressureSkips;
+    if (!Changed) {
+        if (PressureSkips && Options.FnReport) Options.FnReport->skipped("bcf", "register_pressure");
+        return PreservedAnalyses::all();
+    }
+    DTU.flush();
+    if (Options.FnReport) Options.FnReport->applied("bcf");
+    if (Options.Layout) Options.Layout->touched(F);
+
+    PreservedAnalyses PA;
+    PA.preserve<DominatorTreeAnalysis>();
+    PA.preserve<PostDominatorTreeAnalysis>();
+    PA.preserve<LoopAnalysis>();
+    return PA;
 }
 
 }  
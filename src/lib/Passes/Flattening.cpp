@@ -1,6 +1,16 @@
+#include "Obfuscation/Layout.h"
 #include "Obfuscation/Passes.h"
+#include "Obfuscation/Policy.h"
 #include "Obfuscation/Utils.h"
+#include "Obfuscation/Instrumentation.h"
+#include "Obfuscation/Report.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/Analysis/DomTreeUpdater.h"
+#include "llvm/Analysis/PostDominators.h"
 #include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Dominators.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/InstrTypes.h"
@@ -16,156 +26,239 @@ using namespace llvm;
 namespace obfuscator {
 
  
-static uint32_t getKeyForBlock(BasicBlock *BB, 
-                                const std::vector<BasicBlock*> &Blocks,
-                                const std::vector<uint32_t> &Keys) {
-    for (size_t i = 0; i < Blocks.size(); ++i) {
-        if (Blocks[i] == BB) return Keys[i];
+static const size_t MinRegionBlocks = 16;
+
+static int getBlockIndex(BasicBlock *BB, const DenseMap<BasicBlock*, unsigned> &Index) {
+    auto It = Index.find(BB);
+    return It == Index.end() ? -1 : static_cast<int>(It->second);
+}
+
+static void retarget(BasicBlock *BB, BasicBlock *To, std::vector<DominatorTree::UpdateType> &Updates) {
+    SmallPtrSet<BasicBlock*, 4> Seen;
+    for (BasicBlock *Succ : successors(BB)) {
+        if (Seen.insert(Succ).second) Updates.push_back({DominatorTree::Delete, BB, Succ});
     }
-    return 0;
+    Updates.push_back({DominatorTree::Insert, BB, To});
 }
 
-PreservedAnalyses FlatteningPass::run(Module &M, ModuleAnalysisManager &AM) {
-    if (!Options.EnableFla) return PreservedAnalyses::all();
+static unsigned getRegionCount(int SplitNum, size_t NumBlocks) {
+    if (SplitNum <= 1) return 1;
+    size_t MaxRegions = NumBlocks / MinRegionBlocks;
+    return static_cast<unsigned>(std::max<size_t>(1, std::min<size_t>(SplitNum, MaxRegions)));
+}
 
-    bool Changed = false;
+PreservedAnalyses FlatteningPass::run(Function &F, FunctionAnalysisManager &AM) {
+    if (verificationFailed(Options)) return PreservedAnalyses::all();
+    PassPolicy Policy = getFunctionPolicy(Options, F);
+    if (!Policy.EnableFla) {
+        if (Options.EnableFla && Options.FnReport) Options.FnReport->skipped("fla", Policy.Reason);
+        return PreservedAnalyses::all();
+    }
+    
+     
+    if (F.size() < 2) {
+        if (Options.FnReport) Options.FnReport->skipped("fla", "too_few_blocks");
+        return PreservedAnalyses::all();
+    }
 
-    for (Function &F : M) {
-        if (F.isDeclaration()) continue;
-        
-         
-        if (F.hasFnAttribute(Attribute::OptimizeNone)) continue;
-        
-         
-        if (F.getName().starts_with("decrypt_")) continue;
-        
+     
+    std::vector<BasicBlock*> OriginalBBs;
+    BasicBlock *EntryBB = &F.getEntryBlock();
+    
+    for (BasicBlock &BB : F) {
          
-        if (F.size() < 2) continue;
+        if (&BB == EntryBB) continue;
+        if (BB.isEHPad()) continue;
+        if (BB.hasAddressTaken()) continue;
+        OriginalBBs.push_back(&BB);
+    }
 
-         
-        std::vector<BasicBlock*> OriginalBBs;
-        BasicBlock *EntryBB = &F.getEntryBlock();
-        
-        for (BasicBlock &BB : F) {
-             
-            if (&BB == EntryBB) continue;
-            if (BB.isEHPad()) continue;
-            if (BB.hasAddressTaken()) continue;
-            OriginalBBs.push_back(&BB);
-        }
+    if (OriginalBBs.size() < 2) {
+        if (Options.FnReport) Options.FnReport->skipped("fla", "too_few_blocks");
+        return PreservedAnalyses::all();
+    }
 
-        if (OriginalBBs.size() < 2) continue;
+     
+    RandomStream RNG(Options.Seed, "fla", F.getName());
+    DenseMap<BasicBlock*, unsigned> BlockIndex;
+    std::vector<uint32_t> Keys;
+    DenseSet<uint32_t> UsedKeys;
+    for (size_t i = 0; i < OriginalBBs.size(); ++i) {
+        uint32_t Key;
+        do {
+            Key = RNG.range(1, 1000000);
+        } while (!UsedKeys.insert(Key).second);
+        Keys.push_back(Key);
+        BlockIndex[OriginalBBs[i]] = i;
+    }
 
-         
-        std::vector<uint32_t> Keys;
-        for (size_t i = 0; i < OriginalBBs.size(); ++i) {
-            Keys.push_back(Utils::randomRange(1, 1000000));
-        }
+     
+    Instruction *EntryTerm = EntryBB->getTerminator();
+    BranchInst *EntryBI = dyn_cast<BranchInst>(EntryTerm);
+    if (!EntryBI || !EntryBI->isUnconditional()) {
+        if (Options.FnReport) Options.FnReport->skipped("fla", "conditional_entry");
+        return PreservedAnalyses::all();
+    }
+    
+    BasicBlock *FirstSucc = EntryBI->getSuccessor(0);
+    int StartIdx = getBlockIndex(FirstSucc, BlockIndex);
+    if (StartIdx < 0) {
+        if (Options.FnReport) Options.FnReport->skipped("fla", "entry_successor_excluded");
+        return PreservedAnalyses::all();
+    }
 
-         
-        Instruction *EntryTerm = EntryBB->getTerminator();
-        BranchInst *EntryBI = dyn_cast<BranchInst>(EntryTerm);
-        if (!EntryBI || !EntryBI->isUnconditional()) continue;
-        
-        BasicBlock *FirstSucc = EntryBI->getSuccessor(0);
-        uint32_t StartKey = getKeyForBlock(FirstSucc, OriginalBBs, Keys);
-        if (StartKey == 0) continue;  
+     
+    unsigned NumRegions = getRegionCount(Policy.FlaSplitNum, OriginalBBs.size());
+    std::vector<unsigned> RegionOf(OriginalBBs.size());
+    for (size_t i = 0; i < OriginalBBs.size(); ++i) {
+        RegionOf[i] = static_cast<unsigned>(i * NumRegions / OriginalBBs.size());
+    }
 
-         
-        LLVMContext &Ctx = F.getContext();
-        BasicBlock *DispatchBB = BasicBlock::Create(Ctx, "dispatch", &F);
-        BasicBlock *DefaultBB = BasicBlock::Create(Ctx, "switch_default", &F);
-        
-         
-        IRBuilder<> defaultBuilder(DefaultBB);
-        if (F.getReturnType()->isVoidTy()) {
-            defaultBuilder.CreateRetVoid();
-        } else {
-            defaultBuilder.CreateRet(Constant::getNullValue(F.getReturnType()));
-        }
+     
+    LLVMContext &Ctx = F.getContext();
+    IntegerType *I32Ty = Type::getInt32Ty(Ctx);
+    std::vector<DominatorTree::UpdateType> Updates;
+    BasicBlock *DispatchBB = BasicBlock::Create(Ctx, "dispatch", &F);
+    BasicBlock *DefaultBB = BasicBlock::Create(Ctx, "switch_default", &F);
+    
+     
+    IRBuilder<> defaultBuilder(DefaultBB);
+    if (F.getReturnType()->isVoidTy()) {
+        defaultBuilder.CreateRetVoid();
+    } else {
+        defaultBuilder.CreateRet(Constant::getNullValue(F.getReturnType()));
+    }
 
-         
-        IRBuilder<> entryBuilder(EntryBB->getFirstNonPHI());
-        AllocaInst *StateVar = entryBuilder.CreateAlloca(
-            Type::getInt32Ty(Ctx), nullptr, "switch_state");
-        entryBuilder.CreateStore(
-            ConstantInt::get(Type::getInt32Ty(Ctx), StartKey), StateVar);
+     
+    IRBuilder<> entryBuilder(EntryBB->getFirstNonPHI());
+    AllocaInst *StateVar = entryBuilder.CreateAlloca(I32Ty, nullptr, "switch_state");
+    entryBuilder.CreateStore(ConstantInt::get(I32Ty, Keys[StartIdx]), StateVar);
 
-         
-        EntryBI->setSuccessor(0, DispatchBB);
+    AllocaInst *RegionVar = nullptr;
+    if (NumRegions > 1) {
+        RegionVar = entryBuilder.CreateAlloca(I32Ty, nullptr, "switch_region");
+        entryBuilder.CreateStore(ConstantInt::get(I32Ty, RegionOf[StartIdx]), RegionVar);
+    }
 
-         
-        IRBuilder<> dispatchBuilder(DispatchBB);
-        LoadInst *LoadState = dispatchBuilder.CreateLoad(
-            Type::getInt32Ty(Ctx), StateVar, "state_val");
-        SwitchInst *Switch = dispatchBuilder.CreateSwitch(
-            LoadState, DefaultBB, OriginalBBs.size());
+     
+    Updates.push_back({DominatorTree::Delete, EntryBB, FirstSucc});
+    Updates.push_back({DominatorTree::Insert, EntryBB, DispatchBB});
+    EntryBI->setSuccessor(0, DispatchBB);
 
-         
-        for (size_t i = 0; i < OriginalBBs.size(); ++i) {
-            Switch->addCase(
-                ConstantInt::get(Type::getInt32Ty(Ctx), Keys[i]), 
-                OriginalBBs[i]);
+     
+    std::vector<BasicBlock*> RegionDispatch(NumRegions);
+    if (NumRegions == 1) {
+        RegionDispatch[0] = DispatchBB;
+    } else {
+        IRBuilder<> dispatchBuilder(DispatchBB);
+        LoadInst *LoadRegion = dispatchBuilder.CreateLoad(I32Ty, RegionVar, "region_val");
+        SwitchInst *TopSwitch = dispatchBuilder.CreateSwitch(LoadRegion, DefaultBB, NumRegions);
+        for (unsigned r = 0; r < NumRegions; ++r) {
+            RegionDispatch[r] = BasicBlock::Create(Ctx, "region_dispatch", &F);
+            TopSwitch->addCase(ConstantInt::get(I32Ty, r), RegionDispatch[r]);
+            Updates.push_back({DominatorTree::Insert, DispatchBB, RegionDispatch[r]});
         }
+        Updates.push_back({DominatorTree::Insert, DispatchBB, DefaultBB});
+    }
+
+     
+    std::vector<SwitchInst*> RegionSwitch(NumRegions);
+    for (unsigned r = 0; r < NumRegions; ++r) {
+        IRBuilder<> regionBuilder(RegionDispatch[r]);
+        if (Options.Instrument) emitProfileIncrement(regionBuilder, F, "dispatch");
+        LoadInst *LoadState = regionBuilder.CreateLoad(I32Ty, StateVar, "state_val");
+        RegionSwitch[r] = regionBuilder.CreateSwitch(LoadState, DefaultBB);
+        Updates.push_back({DominatorTree::Insert, RegionDispatch[r], DefaultBB});
+    }
+    for (size_t i = 0; i < OriginalBBs.size(); ++i) {
+        RegionSwitch[RegionOf[i]]->addCase(ConstantInt::get(I32Ty, Keys[i]), OriginalBBs[i]);
+        Updates.push_back({DominatorTree::Insert, RegionDispatch[RegionOf[i]], OriginalBBs[i]});
+    }
 
+     
+    // Blocks left as they are when the deadline passes still branch
+    // directly, so the function stays valid.
+    for (size_t i = 0; i < OriginalBBs.size() && !pastDeadline(Options); ++i) {
+        BasicBlock *BB = OriginalBBs[i];
+        Instruction *Term = BB->getTerminator();
+        unsigned Region = RegionOf[i];
+        
+        if (!Term) continue;
+        
          
-        for (size_t i = 0; i < OriginalBBs.size(); ++i) {
-            BasicBlock *BB = OriginalBBs[i];
-            Instruction *Term = BB->getTerminator();
-            
-            if (!Term) continue;
-            
-             
-            if (isa<ReturnInst>(Term)) {
-                continue;
-            }
+        if (isa<ReturnInst>(Term)) {
+            continue;
+        }
+        
+        if (BranchInst *BI = dyn_cast<BranchInst>(Term)) {
+            IRBuilder<> bbBuilder(Term);
             
-            if (BranchInst *BI = dyn_cast<BranchInst>(Term)) {
-                IRBuilder<> bbBuilder(Term);
+            if (BI->isUnconditional()) {
+                int Next = getBlockIndex(BI->getSuccessor(0), BlockIndex);
                 
-                if (BI->isUnconditional()) {
-                    BasicBlock *Succ = BI->getSuccessor(0);
-                    uint32_t NextKey = getKeyForBlock(Succ, OriginalBBs, Keys);
-                    
-                    if (NextKey != 0) {
-                         
-                        bbBuilder.CreateStore(
-                            ConstantInt::get(Type::getInt32Ty(Ctx), NextKey), 
-                            StateVar);
-                        bbBuilder.CreateBr(DispatchBB);
-                        Term->eraseFromParent();
-                    }
+                if (Next >= 0) {
                      
-                    
-                } else {  
-                    BasicBlock *TrueSucc = BI->getSuccessor(0);
-                    BasicBlock *FalseSucc = BI->getSuccessor(1);
-                    
-                    uint32_t TrueKey = getKeyForBlock(TrueSucc, OriginalBBs, Keys);
-                    uint32_t FalseKey = getKeyForBlock(FalseSucc, OriginalBBs, Keys);
-                    
-                     
-                    if (TrueKey != 0 && FalseKey != 0) {
-                        Value *Cond = BI->getCondition();
-                        Value *Select = bbBuilder.CreateSelect(
+                    bbBuilder.CreateStore(ConstantInt::get(I32Ty, Keys[Next]), StateVar);
+                    BasicBlock *To = RegionDispatch[Region];
+                    if (RegionOf[Next] != Region) {
+                        bbBuilder.CreateStore(ConstantInt::get(I32Ty, RegionOf[Next]), RegionVar);
+                        To = DispatchBB;
+                    }
+                    retarget(BB, To, Updates);
+                    bbBuilder.CreateBr(To);
+                    Term->eraseFromParent();
+                }
+                 
+                
+            } else {  
+                int TrueIdx = getBlockIndex(BI->getSuccessor(0), BlockIndex);
+                int FalseIdx = getBlockIndex(BI->getSuccessor(1), BlockIndex);
+                
+                 
+                if (TrueIdx >= 0 && FalseIdx >= 0) {
+                    Value *Cond = BI->getCondition();
+                    Value *Select = bbBuilder.CreateSelect(
+                        Cond,
+                        ConstantInt::get(I32Ty, Keys[TrueIdx]),
+                        ConstantInt::get(I32Ty, Keys[FalseIdx]));
+                    bbBuilder.CreateStore(Select, StateVar);
+                    BasicBlock *To = RegionDispatch[Region];
+                    if (RegionOf[TrueIdx] != Region || RegionOf[FalseIdx] != Region) {
+                        Value *RegionSelect = bbBuilder.CreateSelect(
                             Cond,
-                            ConstantInt::get(Type::getInt32Ty(Ctx), TrueKey),
-                            ConstantInt::get(Type::getInt32Ty(Ctx), FalseKey));
-                        bbBuilder.CreateStore(Select, StateVar);
-                        bbBuilder.CreateBr(DispatchBB);
-                        Term->eraseFromParent();
+                            ConstantInt::get(I32Ty, RegionOf[TrueIdx]),
+                            ConstantInt::get(I32Ty, RegionOf[FalseIdx]));
+                        bbBuilder.CreateStore(RegionSelect, RegionVar);
+                        To = DispatchBB;
                     }
-                     
+                    retarget(BB, To, Updates);
+                    bbBuilder.CreateBr(To);
+                    Term->eraseFromParent();
                 }
+                 
             }
-             
         }
+         
+    }
 
-        if (Options.Stats) Options.Stats->FlattenedFunctions++;
-        Changed = true;
+     
+    DomTreeUpdater DTU(AM.getCachedResult<DominatorTreeAnalysis>(F),
+                       AM.getCachedResult<PostDominatorTreeAnalysis>(F),
+                       DomTreeUpdater::UpdateStrategy::Lazy);
+    DTU.applyUpdates(Updates);
+    DTU.flush();
+
+    if (Options.Stats) {
+        Options.Stats->FlattenedFunctions++;
+        Options.Stats->DispatchRegions += NumRegions;
     }
-    
-    return Changed ? PreservedAnalyses::none() : PreservedAnalyses::all();
+    if (Options.FnReport) Options.FnReport->applied("fla");
+    if (Options.Layout) Options.Layout->touched(F);
+
+    PreservedAnalyses PA;
+    PA.preserve<DominatorTreeAnalysis>();
+    PA.preserve<PostDominatorTreeAnalysis>();
+    return PA;
 }
 
 }  
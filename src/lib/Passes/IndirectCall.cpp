@@ -1,7 +1,11 @@
+#include "Obfuscation/Layout.h"
 #include "Obfuscation/Passes.h"
+#include "Obfuscation/Policy.h"
 #include "Obfuscation/Utils.h"
+#include "Obfuscation/Instrumentation.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/IRBuilder.h"
+#include <optional>
 #include <vector>
 
 using namespace llvm;
@@ -9,14 +13,12 @@ using namespace llvm;
 namespace obfuscator {
 
 PreservedAnalyses IndirectCallPass::run(Module &M, ModuleAnalysisManager &AM) {
-    if (!Options.EnableInd) return PreservedAnalyses::all();
-    
+    if (verificationFailed(Options)) return PreservedAnalyses::all();
     std::vector<CallInst*> Targets;
     
      
     for (Function &F : M) {
-         
-        if (F.getName().startswith("decrypt")) continue;
+        if (F.isDeclaration() || !getFunctionPolicy(Options, F).EnableInd) continue;
         
         for (BasicBlock &BB : F) {
             for (Instruction &I : BB) {
@@ -34,10 +36,16 @@ PreservedAnalyses IndirectCallPass::run(Module &M, ModuleAnalysisManager &AM) {
 
     if (Targets.empty()) return PreservedAnalyses::all();
 
-     
+    Function *Caller = nullptr;
+    std::optional<RandomStream> RNG;
     for (CallInst *CI : Targets) {
         Function *CalledF = CI->getCalledFunction();
         IRBuilder<> builder(CI);
+        if (CI->getFunction() != Caller) {
+            Caller = CI->getFunction();
+            RNG.emplace(Options.Seed, "ind", Caller->getName());
+            if (Options.Layout) Options.Layout->touched(*Caller);
+        }
         
          
          
@@ -59,7 +67,7 @@ PreservedAnalyses IndirectCallPass::run(Module &M, ModuleAnalysisManager &AM) {
          
          
         
-        uint64_t Key = Utils::randomRange(1000000, 9999999);
+        uint64_t Key = RNG->range(1000000, 9999999);
         
          
         Value *FuncInt = builder.CreatePtrToInt(CalledF, Type::getInt64Ty(M.getContext()));
@@ -81,11 +89,15 @@ PreservedAnalyses IndirectCallPass::run(Module &M, ModuleAnalysisManager &AM) {
         Value *LoadedPtr = builder.CreateLoad(CalledF->getType(), PtrStorage);
         
         CI->setCalledOperand(LoadedPtr);
+        if (Options.Instrument) emitProfileIncrement(builder, *CI->getFunction(), "indirect_call");
         
         if (Options.Stats) Options.Stats->IndirectCalls++;
     }
 
-    return PreservedAnalyses::none();
+    PreservedAnalyses PA;
+    PA.preserveSet<CFGAnalyses>();
+    PA.preserve<FunctionAnalysisManagerModuleProxy>();
+    return PA;
 }
 
 }  
@@ -1,8 +1,12 @@
 #include "Obfuscation/Passes.h"
+#include "Obfuscation/Policy.h"
 #include "Obfuscation/Utils.h"
+#include "Obfuscation/Instrumentation.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/GlobalVariable.h"
 #include "llvm/IR/IRBuilder.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/TargetParser/Triple.h"
 #include "llvm/Transforms/Utils/ModuleUtils.h"
 #include <vector>
 
@@ -12,21 +16,172 @@ namespace obfuscator {
 
 struct EncryptedString {
     GlobalVariable *OrigGV;
-    GlobalVariable *NewGV;
+    uint64_t Offset;
     uint8_t Key;
     size_t Length;
 };
 
-PreservedAnalyses StringEncryptionPass::run(Module &M, ModuleAnalysisManager &AM) {
-    if (!Options.EnableStr) return PreservedAnalyses::all();
+// Base page size the target's kernels run with. Only used to report how
+// many pages the decryptor dirties.
+static uint64_t getPageSize(const Triple &T) {
+    return T.isOSDarwin() && T.isAArch64() ? 16384 : 4096;
+}
+
+// Page size of the running system: sysconf(_SC_PAGESIZE) where the constant
+// is known, getpagesize() elsewhere.
+static Value *emitRuntimePageSize(IRBuilder<> &Builder, Module &M, const Triple &T, Type *IntPtrTy) {
+    int SCPageSize = T.isOSLinux() ? 30 : T.isOSDarwin() ? 29 : T.isOSFreeBSD() ? 47 : -1;
+    if (SCPageSize < 0) {
+        FunctionCallee GetPageSize = M.getOrInsertFunction("getpagesize", Builder.getInt32Ty());
+        return Builder.CreateSExt(Builder.CreateCall(GetPageSize), IntPtrTy);
+    }
+    FunctionCallee Sysconf = M.getOrInsertFunction("sysconf", IntPtrTy, Builder.getInt32Ty());
+    return Builder.CreateCall(Sysconf, {Builder.getInt32(SCPageSize)});
+}
+
+// The linker merges the obf_strings of every module into one section and
+// defines symbols for its bounds. They are weak so a JIT that does not
+// provide them sees an empty range.
+static GlobalVariable *getSectionBound(Module &M, StringRef Name) {
+    if (GlobalVariable *GV = M.getGlobalVariable(Name)) return GV;
+    GlobalVariable *GV = new GlobalVariable(M, Type::getInt8Ty(M.getContext()), false,
+                                            GlobalValue::ExternalWeakLinkage, nullptr, Name);
+    GV->setVisibility(GlobalValue::HiddenVisibility);
+    return GV;
+}
+
+// Sets Prot on the whole runtime pages inside the merged section. Partial
+// pages at either end are shared with other data and keep their protection.
+// A failed mprotect aborts rather than leave the strings writable.
+static void emitProtectStrings(IRBuilder<> &Builder, Module &M, const Triple &T, int Prot) {
+    LLVMContext &Ctx = M.getContext();
+    GlobalVariable *Start, *Stop;
+    if (T.isOSBinFormatMachO()) {
+        Start = getSectionBound(M, "\1section$start$__DATA$__obf_strings");
+        Stop = getSectionBound(M, "\1section$end$__DATA$__obf_strings");
+    } else {
+        Start = getSectionBound(M, "__start_obf_strings");
+        Stop = getSectionBound(M, "__stop_obf_strings");
+    }
+
+    Type *IntPtrTy = M.getDataLayout().getIntPtrType(Ctx);
+    Type *I8PtrTy = PointerType::getUnqual(Type::getInt8Ty(Ctx));
+    Value *Mask = Builder.CreateSub(emitRuntimePageSize(Builder, M, T, IntPtrTy), ConstantInt::get(IntPtrTy, 1));
+    Value *Begin = Builder.CreatePtrToInt(Start, IntPtrTy);
+    Value *End = Builder.CreatePtrToInt(Stop, IntPtrTy);
+    Value *First = Builder.CreateAnd(Builder.CreateAdd(Begin, Mask), Builder.CreateNot(Mask));
+    Value *Last = Builder.CreateAnd(End, Builder.CreateNot(Mask));
+    Value *Len = Builder.CreateSelect(Builder.CreateICmpUGT(Last, First), Builder.CreateSub(Last, First),
+                                      ConstantInt::get(IntPtrTy, 0));
+    FunctionCallee Protect = M.getOrInsertFunction("mprotect", Type::getInt32Ty(Ctx), I8PtrTy, IntPtrTy,
+                                                   Type::getInt32Ty(Ctx));
+    Value *Result = Builder.CreateCall(Protect, {Builder.CreateIntToPtr(First, I8PtrTy), Len, Builder.getInt32(Prot)});
+
+    Function *F = Builder.GetInsertBlock()->getParent();
+    BasicBlock *Failed = BasicBlock::Create(Ctx, "protect_failed", F);
+    BasicBlock *Done = BasicBlock::Create(Ctx, "protected", F);
+    Builder.CreateCondBr(Builder.CreateICmpNE(Result, Builder.getInt32(0)), Failed, Done);
+    Builder.SetInsertPoint(Failed);
+    Builder.CreateCall(M.getOrInsertFunction("abort", Type::getVoidTy(Ctx)));
+    Builder.CreateUnreachable();
+    Builder.SetInsertPoint(Done);
+}
+
+// ELF: one sealing constructor per linked image. It lives in a comdat so the
+// linker keeps a single copy and its ctor entry, and runs at priority 1,
+// after the priority 0 decryptors of every module.
+static void emitSealCtor(Module &M, const Triple &T) {
+    const char *Name = "decrypt_strings_seal";
+    if (M.getFunction(Name)) return;
+    LLVMContext &Ctx = M.getContext();
+    Function *Seal = Function::Create(FunctionType::get(Type::getVoidTy(Ctx), false),
+                                      GlobalValue::LinkOnceODRLinkage, Name, &M);
+    Seal->setVisibility(GlobalValue::HiddenVisibility);
+    Seal->setComdat(M.getOrInsertComdat(Name));
+    IRBuilder<> Builder(BasicBlock::Create(Ctx, "entry", Seal));
+    emitProtectStrings(Builder, M, T, 1);
+    Builder.CreateRetVoid();
+    appendToGlobalCtors(M, Seal, 1, Seal);
+}
+
+// Size mode: one loop walks a table of {offset, length, key} entries instead
+// of emitting a loop per string.
+static void emitTableDecrypt(IRBuilder<> &Builder, Function &DecryptFunc, GlobalVariable *StringsGV,
+                             const std::vector<EncryptedString> &Strings) {
+    LLVMContext &Ctx = DecryptFunc.getContext();
+    Type *I8Ty = Type::getInt8Ty(Ctx);
+    Type *I32Ty = Type::getInt32Ty(Ctx);
+    StructType *EntryTy = StructType::get(I32Ty, I32Ty, I8Ty);
+
+    std::vector<Constant*> Entries;
+    for (const EncryptedString &ES : Strings) {
+        Entries.push_back(ConstantStruct::get(EntryTy, {
+            ConstantInt::get(I32Ty, ES.Offset), ConstantInt::get(I32Ty, ES.Length),
+            ConstantInt::get(I8Ty, ES.Key)}));
+    }
+    ArrayType *TableTy = ArrayType::get(EntryTy, Entries.size());
+    GlobalVariable *Table = new GlobalVariable(*DecryptFunc.getParent(), TableTy, true,
+        GlobalValue::PrivateLinkage, ConstantArray::get(TableTy, Entries), "obf_string_table");
+
+    BasicBlock *OuterHeader = BasicBlock::Create(Ctx, "table_header", &DecryptFunc);
+    BasicBlock *OuterBody = BasicBlock::Create(Ctx, "table_body", &DecryptFunc);
+    BasicBlock *LoopHeader = BasicBlock::Create(Ctx, "loop_header", &DecryptFunc);
+    BasicBlock *LoopBody = BasicBlock::Create(Ctx, "loop_body", &DecryptFunc);
+    BasicBlock *OuterLatch = BasicBlock::Create(Ctx, "table_next", &DecryptFunc);
+    BasicBlock *Exit = BasicBlock::Create(Ctx, "table_exit", &DecryptFunc);
+
+    AllocaInst *EntryIdx = Builder.CreateAlloca(I32Ty, nullptr, "s");
+    AllocaInst *Counter = Builder.CreateAlloca(I32Ty, nullptr, "i");
+    Builder.CreateStore(ConstantInt::get(I32Ty, 0), EntryIdx);
+    Builder.CreateBr(OuterHeader);
 
+    Builder.SetInsertPoint(OuterHeader);
+    Value *S = Builder.CreateLoad(I32Ty, EntryIdx);
+    Builder.CreateCondBr(Builder.CreateICmpULT(S, ConstantInt::get(I32Ty, Entries.size())),
+                         OuterBody, Exit);
+
+    Builder.SetInsertPoint(OuterBody);
+    auto loadField = [&](unsigned Field, Type *Ty) {
+        Value *Ptr = Builder.CreateInBoundsGEP(TableTy, Table,
+            {Builder.getInt32(0), S, Builder.getInt32(Field)});
+        return Builder.CreateLoad(Ty, Ptr);
+    };
+    Value *Offset = loadField(0, I32Ty);
+    Value *Length = loadField(1, I32Ty);
+    Value *Key = loadField(2, I8Ty);
+    Builder.CreateStore(ConstantInt::get(I32Ty, 0), Counter);
+    Builder.CreateBr(LoopHeader);
+
+    Builder.SetInsertPoint(LoopHeader);
+    Value *Idx = Builder.CreateLoad(I32Ty, Counter);
+    Builder.CreateCondBr(Builder.CreateICmpULT(Idx, Length), LoopBody, OuterLatch);
+
+    Builder.SetInsertPoint(LoopBody);
+    Value *Pos = Builder.CreateZExt(Builder.CreateAdd(Offset, Idx), Type::getInt64Ty(Ctx));
+    Value *Ptr = Builder.CreateInBoundsGEP(StringsGV->getValueType(), StringsGV, {Builder.getInt64(0), Pos});
+    Builder.CreateStore(Builder.CreateXor(Builder.CreateLoad(I8Ty, Ptr), Key), Ptr);
+    Builder.CreateStore(Builder.CreateAdd(Idx, ConstantInt::get(I32Ty, 1)), Counter);
+    Builder.CreateBr(LoopHeader);
+
+    Builder.SetInsertPoint(OuterLatch);
+    Builder.CreateStore(Builder.CreateAdd(S, ConstantInt::get(I32Ty, 1)), EntryIdx);
+    Builder.CreateBr(OuterHeader);
+
+    Builder.SetInsertPoint(Exit);
+}
+
+PreservedAnalyses StringEncryptionPass::run(Module &M, ModuleAnalysisManager &AM) {
+    if (verificationFailed(Options)) return PreservedAnalyses::all();
     std::vector<EncryptedString> EncryptedStrings;
+    std::vector<uint8_t> Packed;
+    Align StringsAlign;
     LLVMContext &Ctx = M.getContext();
 
      
     for (GlobalVariable &GV : M.globals()) {
         if (!GV.hasInitializer()) continue;
         if (!GV.isConstant()) continue;
+        if (!getGlobalPolicy(Options, GV).EnableStr) continue;
         
         Constant *Init = GV.getInitializer();
         ConstantDataSequential *CDS = dyn_cast<ConstantDataSequential>(Init);
@@ -39,24 +194,19 @@ PreservedAnalyses StringEncryptionPass::run(Module &M, ModuleAnalysisManager &AM
         size_t Len = StrData.size();
         
          
-        uint8_t Key = Utils::randomByte();
+        uint8_t Key = RandomStream(Options.Seed, "str", GV.getName()).byte();
         if (Key == 0) Key = 0x42;  
         
-        std::vector<uint8_t> Encrypted;
+        StringsAlign = std::max(StringsAlign, GV.getAlign().valueOrOne());
+        uint64_t Offset = alignTo(Packed.size(), GV.getAlign().valueOrOne());
+        Packed.resize(Offset);
         for (size_t i = 0; i < Len; ++i) {
-            Encrypted.push_back(static_cast<uint8_t>(StrData[i]) ^ Key);
+            Packed.push_back(static_cast<uint8_t>(StrData[i]) ^ Key);
         }
         
-         
-        Constant *NewInit = ConstantDataArray::get(Ctx, Encrypted);
-        GlobalVariable *NewGV = new GlobalVariable(
-            M, NewInit->getType(), false,  
-            GlobalValue::PrivateLinkage, NewInit, 
-            "enc_" + GV.getName());
-        
         EncryptedString ES;
         ES.OrigGV = &GV;
-        ES.NewGV = NewGV;
+        ES.Offset = Offset;
         ES.Key = Key;
         ES.Length = Len;
         EncryptedStrings.push_back(ES);
@@ -67,9 +217,26 @@ PreservedAnalyses StringEncryptionPass::run(Module &M, ModuleAnalysisManager &AM
     if (EncryptedStrings.empty()) return PreservedAnalyses::all();
 
      
+    Triple T(M.getTargetTriple());
+    Constant *PackedInit = ConstantDataArray::get(Ctx, Packed);
+    GlobalVariable *StringsGV = new GlobalVariable(
+        M, PackedInit->getType(), false,
+        GlobalValue::PrivateLinkage, PackedInit, "obf_strings");
+    StringsGV->setAlignment(StringsAlign);
+    if (T.isOSBinFormatELF()) StringsGV->setSection("obf_strings");
+    else if (T.isOSBinFormatMachO()) StringsGV->setSection("__DATA,__obf_strings");
+    if (Options.Stats) {
+        Options.Stats->StringPages += divideCeil(Packed.size(), getPageSize(T));
+    }
+
+    Type *I64Ty = Type::getInt64Ty(Ctx);
+    std::vector<Constant*> StringPtrs;
     for (auto &ES : EncryptedStrings) {
-         
-        Constant *Cast = ConstantExpr::getBitCast(ES.NewGV, ES.OrigGV->getType());
+        Constant *Indices[] = {ConstantInt::get(I64Ty, 0), ConstantInt::get(I64Ty, ES.Offset)};
+        Constant *Ptr = ConstantExpr::getInBoundsGetElementPtr(PackedInit->getType(), StringsGV, Indices);
+        StringPtrs.push_back(Ptr);
+        
+        Constant *Cast = ConstantExpr::getBitCast(Ptr, ES.OrigGV->getType());
         ES.OrigGV->replaceAllUsesWith(Cast);
         ES.OrigGV->eraseFromParent();
     }
@@ -81,54 +248,77 @@ PreservedAnalyses StringEncryptionPass::run(Module &M, ModuleAnalysisManager &AM
     
     BasicBlock *EntryBB = BasicBlock::Create(Ctx, "entry", DecryptFunc);
     IRBuilder<> Builder(EntryBB);
+    if (T.isOSBinFormatMachO()) emitProtectStrings(Builder, M, T, 3);
 
-     
-    for (auto &ES : EncryptedStrings) {
-        Value *BasePtr = ES.NewGV;
+    if (Options.Outline) {
+        emitTableDecrypt(Builder, *DecryptFunc, StringsGV, EncryptedStrings);
+    } else {
+        for (size_t s = 0; s < EncryptedStrings.size(); ++s) {
+            EncryptedString &ES = EncryptedStrings[s];
+            Value *BasePtr = StringPtrs[s];
         
          
-        BasicBlock *LoopHeader = BasicBlock::Create(Ctx, "loop_header", DecryptFunc);
-        BasicBlock *LoopBody = BasicBlock::Create(Ctx, "loop_body", DecryptFunc);
-        BasicBlock *LoopExit = BasicBlock::Create(Ctx, "loop_exit", DecryptFunc);
+            BasicBlock *LoopHeader = BasicBlock::Create(Ctx, "loop_header", DecryptFunc);
+            BasicBlock *LoopBody = BasicBlock::Create(Ctx, "loop_body", DecryptFunc);
+            BasicBlock *LoopExit = BasicBlock::Create(Ctx, "loop_exit", DecryptFunc);
         
          
-        AllocaInst *Counter = Builder.CreateAlloca(Type::getInt32Ty(Ctx), nullptr, "i");
-        Builder.CreateStore(ConstantInt::get(Type::getInt32Ty(Ctx), 0), Counter);
-        Builder.CreateBr(LoopHeader);
+            AllocaInst *Counter = Builder.CreateAlloca(Type::getInt32Ty(Ctx), nullptr, "i");
+            Builder.CreateStore(ConstantInt::get(Type::getInt32Ty(Ctx), 0), Counter);
+            Builder.CreateBr(LoopHeader);
         
          
-        Builder.SetInsertPoint(LoopHeader);
-        Value *Idx = Builder.CreateLoad(Type::getInt32Ty(Ctx), Counter);
-        Value *Cond = Builder.CreateICmpSLT(
-            Idx, ConstantInt::get(Type::getInt32Ty(Ctx), ES.Length));
-        Builder.CreateCondBr(Cond, LoopBody, LoopExit);
+            Builder.SetInsertPoint(LoopHeader);
+            Value *Idx = Builder.CreateLoad(Type::getInt32Ty(Ctx), Counter);
+            Value *Cond = Builder.CreateICmpSLT(
+                Idx, ConstantInt::get(Type::getInt32Ty(Ctx), ES.Length));
+            Builder.CreateCondBr(Cond, LoopBody, LoopExit);
         
          
-        Builder.SetInsertPoint(LoopBody);
-        Value *Ptr = Builder.CreateInBoundsGEP(
-            Type::getInt8Ty(Ctx), BasePtr, Idx);
-        Value *Val = Builder.CreateLoad(Type::getInt8Ty(Ctx), Ptr);
-        Value *Decrypted = Builder.CreateXor(
-            Val, ConstantInt::get(Type::getInt8Ty(Ctx), ES.Key));
-        Builder.CreateStore(Decrypted, Ptr);
+            Builder.SetInsertPoint(LoopBody);
+            Value *Ptr = Builder.CreateInBoundsGEP(
+                Type::getInt8Ty(Ctx), BasePtr, Idx);
+            Value *Val = Builder.CreateLoad(Type::getInt8Ty(Ctx), Ptr);
+            Value *Decrypted = Builder.CreateXor(
+                Val, ConstantInt::get(Type::getInt8Ty(Ctx), ES.Key));
+            Builder.CreateStore(Decrypted, Ptr);
         
          
-        Value *Inc = Builder.CreateAdd(
-            Idx, ConstantInt::get(Type::getInt32Ty(Ctx), 1));
-        Builder.CreateStore(Inc, Counter);
-        Builder.CreateBr(LoopHeader);
+            Value *Inc = Builder.CreateAdd(
+                Idx, ConstantInt::get(Type::getInt32Ty(Ctx), 1));
+            Builder.CreateStore(Inc, Counter);
+            Builder.CreateBr(LoopHeader);
         
          
-        Builder.SetInsertPoint(LoopExit);
+            Builder.SetInsertPoint(LoopExit);
+        }
     }
     
      
+    if (Options.Instrument) {
+        uint64_t TotalBytes = 0;
+        for (auto &ES : EncryptedStrings) TotalBytes += ES.Length;
+        emitProfileIncrement(Builder, *DecryptFunc, "decrypted_bytes", TotalBytes);
+    }
+
+     
+    // Mach-O runs initializers in link order whatever their priority, so each
+    // decryptor opens the merged section first and seals it again here. On
+    // ELF a single constructor seals it once every module has decrypted.
+    if (T.isOSBinFormatMachO()) {
+        emitProtectStrings(Builder, M, T, 1);
+    } else if (T.isOSBinFormatELF()) {
+        emitSealCtor(M, T);
+    }
     Builder.CreateRetVoid();
 
      
     appendToGlobalCtors(M, DecryptFunc, 0);
 
-    return PreservedAnalyses::none();
+    PreservedAnalyses PA;
+    PA.preserveSet<CFGAnalyses>();
+    PA.preserve<FunctionAnalysisManagerModuleProxy>();
+    return PA;
 }
 
 }  
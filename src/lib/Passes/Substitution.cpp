@@ -1,8 +1,14 @@
+#include "Obfuscation/Layout.h"
 #include "Obfuscation/Passes.h"
+#include "Obfuscation/Policy.h"
+#include "Obfuscation/RegisterPressure.h"
 #include "Obfuscation/Utils.h"
+#include "Obfuscation/Report.h"
+#include "llvm/Analysis/TargetTransformInfo.h"
 #include "llvm/IR/InstrTypes.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/Module.h"
+#include <optional>
 
 using namespace llvm;
 
@@ -50,52 +56,75 @@ void substituteXor(BinaryOperator *BO) {
 }
 
 
-PreservedAnalyses SubstitutionPass::run(Module &M, ModuleAnalysisManager &AM) {
-    if (!Options.EnableSub) return PreservedAnalyses::all();
+PreservedAnalyses SubstitutionPass::run(Function &F, FunctionAnalysisManager &AM) {
+    if (verificationFailed(Options)) return PreservedAnalyses::all();
+    PassPolicy Policy = getFunctionPolicy(Options, F);
+    if (!Policy.EnableSub) return PreservedAnalyses::all();
 
     bool Changed = false;
+    RandomStream RNG(Options.Seed, "sub", F.getName());
 
-    for (Function &F : M) {
-        if (F.isDeclaration()) continue;
-
-         
-        std::vector<BinaryOperator*> candidates;
-        std::vector<Instruction*> toErase;
-
-        for (auto &BB : F) {
-            for (auto &I : BB) {
-                if (auto *BO = dyn_cast<BinaryOperator>(&I)) {
-                    if (BO->getOpcode() == Instruction::Add ||
-                        BO->getOpcode() == Instruction::Sub ||
-                        BO->getOpcode() == Instruction::Xor) {
-                        candidates.push_back(BO);
-                    }
+     
+    std::vector<BinaryOperator*> candidates;
+    std::vector<Instruction*> toErase;
+
+    for (auto &BB : F) {
+        for (auto &I : BB) {
+            if (auto *BO = dyn_cast<BinaryOperator>(&I)) {
+                if (BO->getOpcode() == Instruction::Add ||
+                    BO->getOpcode() == Instruction::Sub ||
+                    BO->getOpcode() == Instruction::Xor) {
+                    candidates.push_back(BO);
                 }
             }
         }
+    }
 
-        for (auto *BO : candidates) {
-             
-            if (!Utils::roll(50)) continue;
-            
-            switch(BO->getOpcode()) {
-                case Instruction::Add: substituteAdd(BO); break;
-                case Instruction::Sub: substituteSub(BO); break;
-                case Instruction::Xor: substituteXor(BO); break;
-                default: continue;
-            }
-            toErase.push_back(BO);
-            if (Options.Stats) Options.Stats->SubstitutedInstrs++;
-            Changed = true;
-        }
+    // Each expansion keeps one temporary live next to the operands, and is
+    // charged to the sites after it in the block.
+    std::optional<RegisterPressure> Pressure;
+    if (Options.RegPressure && !candidates.empty() && hasTargetInfo(*F.getParent())) {
+        Pressure.emplace(F, AM.getResult<TargetIRAnalysis>(F));
+    }
+    int PressureSkips = 0;
 
+    for (auto *BO : candidates) {
+        if (pastDeadline(Options)) break;
          
-        for (auto *I : toErase) {
-            I->eraseFromParent();
+        if (!RNG.roll(Policy.SubProb)) continue;
+        if (Pressure && Pressure->exceedsAt(*BO, 1)) {
+            PressureSkips++;
+            continue;
         }
+        
+        switch(BO->getOpcode()) {
+            case Instruction::Add: substituteAdd(BO); break;
+            case Instruction::Sub: substituteSub(BO); break;
+            case Instruction::Xor: substituteXor(BO); break;
+            default: continue;
+        }
+        toErase.push_back(BO);
+        if (Pressure) Pressure->addLive(*BO->getParent(), BO->getType(), 1);
+        if (Options.Stats) Options.Stats->SubstitutedInstrs++;
+        Changed = true;
+    }
+
+     
+    for (auto *I : toErase) {
+        I->eraseFromParent();
+    }
+
+    if (Options.Stats) Options.Stats->SubPressureSkips += PressureSkips;
+    if (!Changed) {
+        if (PressureSkips && Options.FnReport) Options.FnReport->skipped("sub", "register_pressure");
+        return PreservedAnalyses::all();
     }
+    if (Options.FnReport) Options.FnReport->applied("sub");
+    if (Options.Layout) Options.Layout->touched(F);
 
-    return Changed ? PreservedAnalyses::none() : PreservedAnalyses::all();
+    PreservedAnalyses PA;
+    PA.preserveSet<CFGAnalyses>();
+    return PA;
 }
 
 }  
@@ -0,0 +1,138 @@
+#include "Obfuscation/Layout.h"
+#include "Obfuscation/Passes.h"
+#include "Obfuscation/Report.h"
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+
+using namespace llvm;
+
+namespace obfuscator {
+
+// Copies F into a function outside the module, so taking the snapshot does
+// not add to the module's function list in the middle of a function or CGSCC
+// walk.
+static Function *snapshot(const Function &F) {
+    Function *Copy = Function::Create(F.getFunctionType(), F.getLinkage(), F.getAddressSpace(), F.getName());
+    ValueToValueMapTy VMap;
+    auto DestArg = Copy->arg_begin();
+    for (const Argument &A : F.args()) VMap[&A] = &*DestArg++;
+    SmallVector<ReturnInst *, 8> Returns;
+    CloneFunctionInto(Copy, &F, VMap, CloneFunctionChangeType::LocalChangesOnly, Returns);
+    return Copy;
+}
+
+static void discard(Function *F) {
+    F->dropAllReferences();
+    delete F;
+}
+
+static void replaceBody(Function &F, Function &From) {
+    for (BasicBlock &BB : F) BB.dropAllReferences();
+    while (!F.empty()) F.begin()->eraseFromParent();
+
+    for (unsigned i = 0; i < F.arg_size(); ++i) {
+        From.getArg(i)->replaceAllUsesWith(F.getArg(i));
+    }
+    while (!From.empty()) {
+        BasicBlock *BB = &From.front();
+        BB->removeFromParent();
+        BB->insertInto(&F);
+    }
+    discard(&From);
+}
+
+static GlobalVariable *lastGlobal(Module &M) {
+    return M.global_empty() ? nullptr : &*std::prev(M.global_end());
+}
+
+// New globals are appended to the module, so those after Last came from an
+// abandoned attempt (opaque_x, profile counters). Once its body is gone the
+// ones nothing else refers to are dropped.
+static void eraseUnusedSince(Module &M, GlobalVariable *Last) {
+    auto It = Last ? std::next(Last->getIterator()) : M.global_begin();
+    while (It != M.global_end()) {
+        GlobalVariable &GV = *It++;
+        GV.removeDeadConstantUsers();
+        if (GV.use_empty()) GV.eraseFromParent();
+    }
+}
+
+PreservedAnalyses FunctionWatchdogPass::run(Function &F, FunctionAnalysisManager &AM) {
+    if (verificationFailed(Options)) return PreservedAnalyses::all();
+    if (!Sub && !Bcf && !Fla) return PreservedAnalyses::all();
+
+    FunctionDeadline Deadline(Options.FnTimeLimitMs);
+    ObfuscationOptions Opts = Options;
+    Opts.Deadline = &Deadline;
+    // A restored function is not touched, so the layout learns the outcome
+    // from the watchdog rather than from the passes.
+    Opts.Layout = nullptr;
+    unsigned OrgInstrs = F.getInstructionCount();
+    auto overLimit = [&]() -> const char * {
+        if (Deadline.expired()) return "time_limit";
+        if (Options.FnGrowthLimit > 0 && F.getInstructionCount() > OrgInstrs * Options.FnGrowthLimit) {
+            return "growth_limit";
+        }
+        return nullptr;
+    };
+
+    Function *Pristine = snapshot(F);
+    GlobalVariable *LastGlobal = lastGlobal(*F.getParent());
+    ObfuscationStats SavedStats;
+    if (Options.Stats) SavedStats = *Options.Stats;
+
+    struct Tier { const char *Name; bool Sub, Bcf, Fla; };
+    const Tier Tiers[] = {
+        {"full", Sub, Bcf, Fla},
+        {"reduced", Sub, false, false},
+    };
+
+    const char *Reason = nullptr;
+    for (size_t i = 0; i < sizeof(Tiers) / sizeof(Tiers[0]); ++i) {
+        const Tier &T = Tiers[i];
+        if (Reason) {
+            if (!T.Sub && !T.Bcf && !T.Fla) continue;
+            if (T.Sub == Sub && T.Bcf == Bcf && T.Fla == Fla) continue;
+            replaceBody(F, *snapshot(*Pristine));
+            eraseUnusedSince(*F.getParent(), LastGlobal);
+            AM.invalidate(F, PreservedAnalyses::none());
+            if (Options.Stats) *Options.Stats = SavedStats;
+            if (Options.FnReport) Options.FnReport->fallback(T.Name, Reason);
+            Deadline.restart();
+        }
+
+        Reason = nullptr;
+        PreservedAnalyses PA = PreservedAnalyses::all();
+        auto runPass = [&](auto &&Pass) {
+            PreservedAnalyses PassPA = Pass.run(F, AM);
+            AM.invalidate(F, PassPA);
+            PA.intersect(std::move(PassPA));
+            Reason = overLimit();
+        };
+        if (T.Sub && !Reason) runPass(SubstitutionPass(Opts));
+        if (T.Bcf && !Reason) runPass(BogusControlFlowPass(Opts));
+        if (T.Fla && !Reason) runPass(FlatteningPass(Opts));
+        if (!Reason) {
+            if (i > 0 && Options.Stats) Options.Stats->WatchdogFallbacks++;
+            discard(Pristine);
+            if (!PA.areAllPreserved() && Options.Layout) Options.Layout->touched(F);
+            if (i > 0) return PreservedAnalyses::none();
+            return PA;
+        }
+    }
+
+    replaceBody(F, *Pristine);
+    eraseUnusedSince(*F.getParent(), LastGlobal);
+    AM.invalidate(F, PreservedAnalyses::none());
+    if (Options.Stats) {
+        *Options.Stats = SavedStats;
+        Options.Stats->WatchdogFallbacks++;
+    }
+    if (Options.FnReport) Options.FnReport->fallback("none", Reason);
+    return PreservedAnalyses::none();
+}
+
+}
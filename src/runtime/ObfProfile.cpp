@@ -0,0 +1,75 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct ModuleCounters {
+    const char *Desc;
+    uint32_t Count;
+    void (*Collect)(uint64_t *);
+    std::vector<uint64_t> Totals;
+};
+
+std::mutex &getLock() {
+    static std::mutex Lock;
+    return Lock;
+}
+
+std::vector<ModuleCounters> &getModules() {
+    static std::vector<ModuleCounters> Modules;
+    return Modules;
+}
+
+void collectThread() {
+    std::lock_guard<std::mutex> Guard(getLock());
+    for (ModuleCounters &MC : getModules()) MC.Collect(MC.Totals.data());
+}
+
+struct ThreadFlusher {
+    ~ThreadFlusher() { collectThread(); }
+};
+
+thread_local ThreadFlusher Flusher;
+
+void dump() {
+    collectThread();
+
+    const char *Path = std::getenv("OBF_PROFILE_FILE");
+    if (!Path || !*Path) Path = "obfuscation.profile";
+    FILE *F = std::fopen(Path, "w");
+    if (!F) return;
+
+    std::fprintf(F, "# obfuscation-profile v1\n");
+    std::lock_guard<std::mutex> Guard(getLock());
+    for (const ModuleCounters &MC : getModules()) {
+        const char *Line = MC.Desc;
+        for (uint32_t i = 0; i < MC.Count && *Line; ++i) {
+            const char *End = Line;
+            while (*End && *End != '\n') ++End;
+            std::fprintf(F, "%.*s\t%llu\n", (int)(End - Line), Line,
+                         (unsigned long long)MC.Totals[i]);
+            Line = *End ? End + 1 : End;
+        }
+    }
+    std::fclose(F);
+}
+
+}
+
+extern "C" void __obf_prof_register(const char *Desc, uint32_t Count,
+                                    void (*Collect)(uint64_t *)) {
+    {
+        std::lock_guard<std::mutex> Guard(getLock());
+        getModules().push_back({Desc, Count, Collect, std::vector<uint64_t>(Count, 0)});
+    }
+    static std::once_flag Once;
+    std::call_once(Once, [] { std::atexit(dump); });
+}
+
+extern "C" void __obf_prof_thread_init() {
+    (void)&Flusher;
+}
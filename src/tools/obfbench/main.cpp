@@ -0,0 +1,344 @@
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <fstream>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+using namespace llvm;
+
+static cl::opt<unsigned> Runs("runs", cl::desc("Number of times to run the command"), cl::init(5));
+static cl::opt<unsigned> Parallel("parallel", cl::desc("Copies kept running at the same time"), cl::init(1));
+static cl::opt<bool> Counters("counters", cl::desc("Collect hardware performance counters with perf_event_open (Linux)"), cl::init(true));
+static cl::opt<std::string> Label("label", cl::desc("Pass configuration the command was built with, copied into the report"), cl::value_desc("name"));
+static cl::opt<std::string> BaselineFile("baseline", cl::desc("Report ratios against an earlier obfbench report"), cl::value_desc("file"));
+static cl::opt<std::string> Program(cl::Positional, cl::Required, cl::desc("<command>"));
+static cl::list<std::string> Args(cl::ConsumeAfter, cl::desc("<args>..."));
+
+static const char *const CounterNames[] = {
+    "cycles", "instructions", "branch_misses", "l1i_misses", "itlb_misses",
+};
+constexpr size_t NumCounters = sizeof(CounterNames) / sizeof(CounterNames[0]);
+
+struct RunResult {
+    double WallMs = 0;
+    uint64_t MaxRssKb = 0;
+    uint64_t PrivateDirtyKb = 0;
+    int Status = 0;
+    std::optional<uint64_t> Counters[NumCounters];
+};
+
+#ifdef __linux__
+
+static uint64_t cacheMiss(uint64_t Cache) {
+    return Cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+}
+
+static const struct {
+    uint32_t Type;
+    uint64_t Config;
+} CounterEvents[NumCounters] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {PERF_TYPE_HW_CACHE, cacheMiss(PERF_COUNT_HW_CACHE_L1I)},
+    {PERF_TYPE_HW_CACHE, cacheMiss(PERF_COUNT_HW_CACHE_ITLB)},
+};
+
+static std::string CounterError;
+
+// User-space counts for Pid and everything it starts, from its exec onward.
+// Events the CPU or kernel does not offer get -1.
+static void openCounters(pid_t Pid, int (&Fds)[NumCounters]) {
+    for (size_t i = 0; i < NumCounters; ++i) {
+        struct perf_event_attr Attr;
+        memset(&Attr, 0, sizeof(Attr));
+        Attr.size = sizeof(Attr);
+        Attr.type = CounterEvents[i].Type;
+        Attr.config = CounterEvents[i].Config;
+        Attr.disabled = 1;
+        Attr.enable_on_exec = 1;
+        Attr.inherit = 1;
+        Attr.exclude_kernel = 1;
+        Attr.exclude_hv = 1;
+        Attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        Fds[i] = syscall(SYS_perf_event_open, &Attr, Pid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+        if (Fds[i] < 0 && CounterError.empty()) CounterError = strerror(errno);
+    }
+}
+
+// Scaled up when the kernel had to multiplex the counters.
+static void readCounters(int (&Fds)[NumCounters], RunResult &R) {
+    for (size_t i = 0; i < NumCounters; ++i) {
+        if (Fds[i] < 0) continue;
+        uint64_t Values[3];
+        if (read(Fds[i], Values, sizeof(Values)) == sizeof(Values) && Values[2]) {
+            R.Counters[i] = static_cast<uint64_t>(static_cast<double>(Values[0]) * Values[1] / Values[2]);
+        }
+        close(Fds[i]);
+        Fds[i] = -1;
+    }
+}
+
+#else
+
+static void openCounters(pid_t, int (&Fds)[NumCounters]) {
+    for (int &Fd : Fds) Fd = -1;
+}
+
+static void readCounters(int (&)[NumCounters], RunResult &) {}
+
+#endif
+
+#ifndef _WIN32
+
+// Private_Dirty of a live process, which is what each extra copy of a
+// program really costs. Only available on Linux; 0 elsewhere.
+static uint64_t readPrivateDirtyKb(pid_t Pid) {
+    std::ifstream In("/proc/" + std::to_string(Pid) + "/smaps_rollup");
+    std::string Key;
+    uint64_t Value;
+    while (In >> Key) {
+        if (Key == "Private_Dirty:" && In >> Value) return Value;
+        In.ignore(256, '\n');
+    }
+    return 0;
+}
+
+// pipe2 is not available on macOS.
+static bool openGoPipe(int (&Fds)[2]) {
+    if (pipe(Fds) != 0) return false;
+    for (int Fd : Fds) fcntl(Fd, F_SETFD, FD_CLOEXEC);
+    return true;
+}
+
+// The child waits on a pipe until its counters are attached, so they cover
+// the whole of the exec'd program and nothing of obfbench.
+static pid_t spawn(std::vector<char*> &Argv, int (&CounterFds)[NumCounters]) {
+    for (int &Fd : CounterFds) Fd = -1;
+    int Go[2] = {-1, -1};
+    if (Counters && !openGoPipe(Go)) return -1;
+    pid_t Pid = fork();
+    if (Pid == 0) {
+        if (Counters) {
+            char C;
+            close(Go[1]);
+            while (read(Go[0], &C, 1) < 0 && errno == EINTR) {}
+        }
+        execvp(Argv[0], Argv.data());
+        _exit(127);
+    }
+    if (Counters) {
+        close(Go[0]);
+        if (Pid > 0) openCounters(Pid, CounterFds);
+        close(Go[1]);
+    }
+    return Pid;
+}
+
+static std::vector<RunResult> runAll(std::vector<char*> &Argv) {
+    struct Live {
+        pid_t Pid;
+        std::chrono::steady_clock::time_point Start;
+        uint64_t PrivateDirtyKb;
+        int CounterFds[NumCounters];
+    };
+    std::vector<RunResult> Results;
+    std::vector<Live> Running;
+    unsigned Started = 0;
+
+    while (Results.size() < Runs) {
+        while (Started < Runs && Running.size() < std::max(1u, unsigned(Parallel))) {
+            Running.emplace_back();
+            Live &L = Running.back();
+            L.Pid = spawn(Argv, L.CounterFds);
+            if (L.Pid < 0) {
+                Running.pop_back();
+                return Results;
+            }
+            L.Start = std::chrono::steady_clock::now();
+            L.PrivateDirtyKb = 0;
+            Started++;
+        }
+        for (size_t i = 0; i < Running.size();) {
+            Live &L = Running[i];
+            L.PrivateDirtyKb = std::max(L.PrivateDirtyKb, readPrivateDirtyKb(L.Pid));
+
+            int Status;
+            struct rusage Usage;
+            pid_t Done = wait4(L.Pid, &Status, WNOHANG, &Usage);
+            if (Done != L.Pid) {
+                ++i;
+                continue;
+            }
+            RunResult R;
+            std::chrono::duration<double, std::milli> Elapsed = std::chrono::steady_clock::now() - L.Start;
+            R.WallMs = Elapsed.count();
+#ifdef __APPLE__
+            R.MaxRssKb = Usage.ru_maxrss / 1024;
+#else
+            R.MaxRssKb = Usage.ru_maxrss;
+#endif
+            R.PrivateDirtyKb = L.PrivateDirtyKb;
+            R.Status = WIFEXITED(Status) ? WEXITSTATUS(Status) : -1;
+            readCounters(L.CounterFds, R);
+            Results.push_back(R);
+            Running.erase(Running.begin() + i);
+        }
+        usleep(1000);
+    }
+    return Results;
+}
+
+#endif
+
+template <typename T>
+static double median(std::vector<T> Values) {
+    if (Values.empty()) return 0;
+    std::sort(Values.begin(), Values.end());
+    size_t N = Values.size();
+    return N % 2 ? Values[N / 2] : (Values[N / 2 - 1] + Values[N / 2]) / 2.0;
+}
+
+static std::optional<double> ratio(std::optional<double> Value, std::optional<double> Base) {
+    if (!Value || !Base || *Base == 0) return std::nullopt;
+    return *Value / *Base;
+}
+
+static std::optional<double> getNumber(const json::Object *O, StringRef Key) {
+    if (O) {
+        if (auto N = O->getNumber(Key)) return *N;
+    }
+    return std::nullopt;
+}
+
+int main(int argc, char **argv) {
+    cl::ParseCommandLineOptions(argc, argv, "Obfuscation benchmark runner\n");
+
+#ifdef _WIN32
+    errs() << "Error: obfbench is not supported on Windows.\n";
+    return 1;
+#else
+    std::vector<char*> Argv;
+    Argv.push_back(&Program[0]);
+    for (std::string &Arg : Args) Argv.push_back(&Arg[0]);
+    Argv.push_back(nullptr);
+
+    std::optional<json::Value> Baseline;
+    if (!BaselineFile.empty()) {
+        ErrorOr<std::unique_ptr<MemoryBuffer>> Buf = MemoryBuffer::getFile(BaselineFile);
+        if (!Buf) {
+            errs() << "Error reading " << BaselineFile << ": " << Buf.getError().message() << "\n";
+            return 1;
+        }
+        Expected<json::Value> Parsed = json::parse((*Buf)->getBuffer());
+        if (!Parsed || !Parsed->getAsObject()) {
+            errs() << "Error: " << BaselineFile << " is not an obfbench report";
+            if (!Parsed) errs() << ": " << toString(Parsed.takeError());
+            errs() << "\n";
+            return 1;
+        }
+        Baseline = std::move(*Parsed);
+    }
+
+    std::vector<RunResult> Results = runAll(Argv);
+
+    std::vector<double> Wall;
+    std::vector<uint64_t> Rss, Dirty;
+    int Failures = 0;
+    for (const RunResult &R : Results) {
+        Wall.push_back(R.WallMs);
+        Rss.push_back(R.MaxRssKb);
+        Dirty.push_back(R.PrivateDirtyKb);
+        if (R.Status != 0) Failures++;
+    }
+
+    std::optional<double> CounterMedians[NumCounters];
+    bool AnyCounter = false;
+    for (size_t i = 0; i < NumCounters; ++i) {
+        std::vector<uint64_t> Values;
+        for (const RunResult &R : Results) {
+            if (R.Counters[i]) Values.push_back(*R.Counters[i]);
+        }
+        if (Values.empty()) continue;
+        CounterMedians[i] = median(Values);
+        AnyCounter = true;
+    }
+    if (Counters && !AnyCounter) {
+#ifdef __linux__
+        errs() << "warning: hardware counters unavailable (" << (CounterError.empty() ? "no samples" : CounterError)
+               << "), reporting timing only\n";
+#else
+        errs() << "warning: hardware counters need Linux perf_event_open, reporting timing only\n";
+#endif
+    }
+
+    json::OStream J(outs(), 2);
+    J.object([&] {
+        if (!Label.empty()) J.attribute("label", Label);
+        J.attribute("runs", static_cast<int64_t>(Results.size()));
+        J.attribute("parallel", static_cast<int64_t>(Parallel));
+        J.attribute("failures", Failures);
+        J.attribute("wall_ms_median", median(Wall));
+        J.attribute("max_rss_kb_median", median(Rss));
+        J.attribute("private_dirty_kb_median", median(Dirty));
+        if (!AnyCounter) {
+            J.attribute("counters", nullptr);
+        } else {
+            J.attributeObject("counters", [&] {
+                for (size_t i = 0; i < NumCounters; ++i) {
+                    if (CounterMedians[i]) J.attribute(CounterNames[i], *CounterMedians[i]);
+                    else J.attribute(CounterNames[i], nullptr);
+                }
+            });
+            // Misses per thousand instructions separate a slower mix of code
+            // from simply running more of it.
+            J.attributeObject("per_kilo_instruction", [&] {
+                std::optional<double> KiloInstrs;
+                if (CounterMedians[1]) KiloInstrs = *CounterMedians[1] / 1000;
+                for (size_t i = 2; i < NumCounters; ++i) {
+                    if (std::optional<double> R = ratio(CounterMedians[i], KiloInstrs)) J.attribute(CounterNames[i], *R);
+                    else J.attribute(CounterNames[i], nullptr);
+                }
+            });
+        }
+        if (Baseline) {
+            const json::Object &B = *Baseline->getAsObject();
+            const json::Object *BC = B.getObject("counters");
+            J.attributeObject("vs_baseline", [&] {
+                if (auto BL = B.getString("label")) J.attribute("label", *BL);
+                auto emit = [&](StringRef Key, std::optional<double> R) {
+                    if (R) J.attribute(Key, *R);
+                    else J.attribute(Key, nullptr);
+                };
+                emit("wall_ms", ratio(median(Wall), getNumber(&B, "wall_ms_median")));
+                for (size_t i = 0; i < NumCounters; ++i) {
+                    emit(CounterNames[i], ratio(CounterMedians[i], getNumber(BC, CounterNames[i])));
+                }
+            });
+        }
+    });
+    outs() << "\n";
+    return Failures ? 1 : 0;
+#endif
+}
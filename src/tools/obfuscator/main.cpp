@@ -1,27 +1,47 @@
 #include "Obfuscation/Config.h"
-#include "Obfuscation/Passes.h"
+#include "Obfuscation/Engine.h"
+#include "Obfuscation/Presets.h"
+#include "Obfuscation/Autotuner.h"
+#include "Obfuscation/CodeGen.h"
+#include "Obfuscation/Server.h"
 #include "Obfuscation/Utils.h"
+#include "Obfuscation/Report.h"
+#include "Obfuscation/Verification.h"
+#include "Obfuscation/Variants.h"
+#include "Obfuscation/Layout.h"
+#include "Obfuscation/MachineReport.h"
+#include "Obfuscation/JIT.h"
+#include "Obfuscation/Policy.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
-#include "llvm/IR/Verifier.h"
 #include "llvm/IRReader/IRReader.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Bitcode/BitcodeReader.h"
 #include "llvm/Bitcode/BitcodeWriter.h"
-#include "llvm/Passes/PassBuilder.h"
-#include "llvm/Analysis/CGSCCPassManager.h"
-#include "llvm/Analysis/LoopAnalysisManager.h"
-#include <fstream>
+#include "llvm/Support/Path.h"
+#include "llvm/Support/SystemUtils.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include <chrono>
 #include <iostream>
 #include <cstdlib>
 
 using namespace llvm;
 using namespace obfuscator;
 
-static cl::opt<std::string> InputFilename(cl::Positional, cl::desc("<input file>"), cl::Required);
-static cl::opt<std::string> OutputFilename("o", cl::desc("Output filename"), cl::value_desc("filename"));
+static cl::opt<std::string> InputFilename(cl::Positional, cl::desc("<input file, - for stdin>"));
+static cl::opt<std::string> OutputFilename("o", cl::desc("Output filename, - for stdout"), cl::value_desc("filename"));
+
+enum OutputFileType { OFT_Bitcode, OFT_Object };
+static cl::opt<OutputFileType> FileType("filetype", cl::desc("Output file type"),
+    cl::values(clEnumValN(OFT_Bitcode, "bc", "LLVM bitcode (default)"),
+               clEnumValN(OFT_Object, "obj", "Native relocatable object")),
+    cl::init(OFT_Bitcode));
+static cl::opt<unsigned> CodegenSplit("codegen-split", cl::desc("Compile -filetype=obj output in N parallel partitions (0 = all cores)"), cl::init(1));
+static cl::opt<std::string> RelocatableLinker("relocatable-linker", cl::desc("Linker used to merge codegen partitions with -r"), cl::init("ld.lld"));
 
 static cl::opt<bool> EnableFla("fla", cl::desc("Enable Control Flow Flattening"));
 static cl::opt<bool> EnableBcf("bcf", cl::desc("Enable Bogus Control Flow"));
@@ -31,29 +51,186 @@ static cl::opt<bool> EnableInd("ind", cl::desc("Enable Indirect Calls"));
 
 static cl::opt<int> FlaSplit("fla-split", cl::desc("Flattening Split Number"), cl::init(3));
 static cl::opt<int> BcfProb("bcf-prob", cl::desc("Bogus Control Flow Probability"), cl::init(50));
+static cl::opt<int> BcfLoop("bcf-loop", cl::desc("Bogus Control Flow Iterations"), cl::init(1));
+static cl::opt<int> SubProb("sub-prob", cl::desc("Instruction Substitution Probability"), cl::init(50));
 static cl::opt<uint64_t> Seed("seed", cl::desc("Random Seed"), cl::init(0));
 static cl::opt<bool> GenReport("report", cl::desc("Generate obfuscation report"));
+static cl::opt<unsigned> OptLevel("O", cl::desc("Run the standard -O<N> pipeline around the obfuscation passes"), cl::Prefix, cl::init(0));
+static cl::list<std::string> Placements("place", cl::desc("Pipeline placement <pass>=<start|scalar-late|vectorizer-start|optimizer-last>"), cl::CommaSeparated);
+static cl::opt<bool> Outline("outline", cl::desc("Size mode: evaluate opaque predicates in a few shared helpers and decrypt strings from a table"));
+static cl::opt<bool> RegPressure("reg-pressure", cl::desc("Skip bogus flow and substitutions where they would push live values past the target's register budget"));
+static cl::opt<bool> Instrument("instrument", cl::desc("Add runtime overhead counters (link with ObfuscationProfile)"));
+static cl::opt<unsigned> FnTimeLimit("fn-time-limit", cl::desc("Per-function obfuscation time limit in milliseconds, checked between blocks (0 = off)"), cl::init(0));
+static cl::opt<double> FnGrowthLimit("fn-growth-limit", cl::desc("Per-function instruction growth limit as a ratio (0 = off)"), cl::init(0));
+static cl::opt<ObfuscationLevel> Level("level", cl::desc("Obfuscation preset level"),
+    cl::values(clEnumValN(ObfuscationLevel::None, "none", "No obfuscation"),
+               clEnumValN(ObfuscationLevel::Low, "low", "Runtime x1.1, size x1.5"),
+               clEnumValN(ObfuscationLevel::Medium, "medium", "Runtime x1.5, size x2.5"),
+               clEnumValN(ObfuscationLevel::High, "high", "Runtime x2.5, size x4"),
+               clEnumValN(ObfuscationLevel::Aggressive, "aggressive", "Runtime x5, size x8"),
+               clEnumValN(ObfuscationLevel::Insane, "insane", "Unbounded overhead")),
+    cl::init(ObfuscationLevel::None));
+static cl::opt<std::string> PresetFile("preset", cl::desc("Load a tuned level preset"), cl::value_desc("file"));
+static cl::opt<bool> Autotune("autotune", cl::desc("Tune the -level preset against -bench-cmd and write it to -preset-out"));
+static cl::opt<std::string> BenchCmd("bench-cmd", cl::desc("Benchmark command, {} is replaced with the bitcode path"), cl::value_desc("command"));
+static cl::opt<int> TuneTrials("autotune-trials", cl::desc("Number of configurations to try"), cl::init(24));
+static cl::opt<int> BenchRuns("bench-runs", cl::desc("Benchmark runs per configuration"), cl::init(3));
+static cl::opt<std::string> PresetOut("preset-out", cl::desc("Tuned preset output file"), cl::value_desc("file"));
+static cl::opt<std::string> ServeSocket("serve", cl::desc("Run as a server on the Unix domain socket <path>"), cl::value_desc("path"));
+static cl::opt<unsigned> ServerThreads("server-threads", cl::desc("Worker threads for -serve (0 = all cores)"), cl::init(0));
+static cl::opt<unsigned> ServerTimeout("server-timeout", cl::desc("Drop a -serve client that sends nothing for <s> seconds (0 = never)"), cl::value_desc("s"), cl::init(30));
+static cl::opt<unsigned> ServerMaxInput("server-max-input", cl::desc("Largest IR a -serve request may carry, in MiB"), cl::value_desc("MiB"), cl::init(256));
+static cl::opt<std::string> ConnectSocket("connect", cl::desc("Obfuscate through the server listening on <path>"), cl::value_desc("path"));
+static cl::opt<VerifyMode> VerifyIR("verify-ir", cl::desc("Verify the functions each obfuscation pass changes, then the module-level invariants"),
+    cl::values(clEnumValN(VerifyMode::Full, "full", "Every changed function (default)"),
+               clEnumValN(VerifyMode::Sampled, "sampled", "About one in -verify-sample functions"),
+               clEnumValN(VerifyMode::Off, "off", "No verification")),
+    cl::init(VerifyMode::Full));
+static cl::opt<bool> VerifyModule("verify-module", cl::desc("End -verify-ir with a full verifyModule, re-checking every function on one thread"));
+static cl::opt<unsigned> VerifySample("verify-sample", cl::desc("Sampling rate for -verify-ir=sampled"), cl::init(8));
+static cl::opt<unsigned> VerifyThreads("verify-threads", cl::desc("Worker threads for verification (0 = all cores)"), cl::init(0));
+static cl::opt<unsigned> Variants("variants", cl::desc("Write N variants seeded from -seed; -o may contain {} for the index"), cl::init(1));
+static cl::opt<unsigned> VariantThreads("variant-threads", cl::desc("Worker threads for -variants (0 = all cores)"), cl::init(0));
+static cl::opt<bool> LayoutHints("layout", cl::desc("Place obfuscated functions in .text.hot / .text.unlikely by estimated hotness"));
+static cl::opt<std::string> OrderFile("order-file", cl::desc("Write a link order file for the obfuscated functions"), cl::value_desc("file"));
+static cl::opt<std::string> PolicyFile("policy", cl::desc("Choose passes and strengths per function and global from a JSON or YAML policy"), cl::value_desc("file"));
+static cl::opt<std::string> MachineReportPath("report-mc", cl::desc("Lower the module before and after obfuscation and write per-function machine-code figures to <file>"), cl::value_desc("file"));
+static cl::opt<std::string> JITReportPath("report-jit", cl::desc("Compile each function on its own as a lazy JIT would, with and without obfuscation, and write per-function compile latency to <file>"), cl::value_desc("file"));
+static cl::opt<bool> RunJIT("run-jit", cl::desc("Run main in an LLLazyJIT that obfuscates each function on its first call, and exit with its status"));
+static cl::list<std::string> JITArgs("jit-arg", cl::desc("Argument passed to main under -run-jit"), cl::value_desc("arg"));
+static cl::opt<bool> TimePhases("time-phases", cl::desc("Print the wall time of the startup, parse, obfuscate and write phases"));
+static cl::opt<std::string> FunctionReportPath("report-functions", cl::desc("Stream a per-function JSON Lines report to <file>"), cl::value_desc("file"));
+
+// Taken during static initialization, so startup includes the time spent
+// before main.
+static const std::chrono::steady_clock::time_point ToolStart = std::chrono::steady_clock::now();
 
-void generateReport(const std::string &path, const ObfuscationStats &stats) {
-    std::ofstream out(path);
-    out << "{\n";
-    out << "  \"obfuscation_metrics\": {\n";
-    out << "    \"flattened_functions\": " << stats.FlattenedFunctions << ",\n";
-    out << "    \"bogus_blocks\": " << stats.BogusBlocks << ",\n";
-    out << "    \"opaque_predicates\": " << stats.OpaquePredicates << ",\n";
-    out << "    \"encrypted_strings\": " << stats.EncryptedStrings << ",\n";
-    out << "    \"substituted_instructions\": " << stats.SubstitutedInstrs << ",\n";
-    out << "    \"indirect_calls\": " << stats.IndirectCalls << "\n";
-    out << "  }\n";
-    out << "}\n";
-    out.close();
+static bool isSourceFile(StringRef Path) {
+    StringRef Ext = sys::path::extension(Path);
+    return Ext == ".c" || Ext == ".cc" || Ext == ".cpp" || Ext == ".cxx";
+}
+
+bool generateReport(const std::string &path, const ObfuscationStats &stats, uint64_t seed) {
+    std::error_code EC;
+    raw_fd_ostream out(path, EC, sys::fs::OF_Text);
+    if (EC) {
+        errs() << "Error opening report file: " << EC.message() << "\n";
+        return false;
+    }
+    writeStatsReport(out, stats, seed);
+    return true;
 }
 
 int main(int argc, char **argv) {
+    PhaseTimer Phases(ToolStart);
     cl::ParseCommandLineOptions(argc, argv, "LLVM Obfuscator\n");
+
+    if (!ServeSocket.empty()) {
+        ServerOptions SO;
+        SO.SocketPath = ServeSocket;
+        SO.Threads = ServerThreads;
+        SO.ReadTimeoutSec = ServerTimeout;
+        SO.MaxInputBytes = uint64_t(ServerMaxInput) << 20;
+        if (Error E = runServer(SO)) {
+            errs() << "Error: " << toString(std::move(E)) << "\n";
+            return 1;
+        }
+        return 0;
+    }
+
+    if (InputFilename.empty()) {
+        errs() << "Error: no input file.\n";
+        return 1;
+    }
     
+    ObfuscationStats Stats;
+    ObfuscationOptions Opts;
+    applyLevel(Opts, Level);
+    if (!PresetFile.empty()) {
+        if (Error E = loadPreset(PresetFile, Opts)) {
+            errs() << "Error loading preset: " << toString(std::move(E)) << "\n";
+            return 1;
+        }
+    }
+    if (EnableFla) Opts.EnableFla = true;
+    if (EnableBcf) Opts.EnableBcf = true;
+    if (EnableSub) Opts.EnableSub = true;
+    if (EnableStr) Opts.EnableStr = true;
+    if (EnableInd) Opts.EnableInd = true;
+    if (FlaSplit.getNumOccurrences()) Opts.FlaSplitNum = FlaSplit.getValue();
+    if (BcfProb.getNumOccurrences()) Opts.BcfProb = BcfProb.getValue();
+    if (BcfLoop.getNumOccurrences()) Opts.BcfLoop = BcfLoop.getValue();
+    if (SubProb.getNumOccurrences()) Opts.SubProb = SubProb.getValue();
+    if (OptLevel.getNumOccurrences()) Opts.OptLevel = OptLevel.getValue();
+    if (Instrument) Opts.Instrument = true;
+    if (Outline) Opts.Outline = true;
+    if (RegPressure.getNumOccurrences()) Opts.RegPressure = RegPressure;
+    if (FnTimeLimit.getNumOccurrences()) Opts.FnTimeLimitMs = FnTimeLimit.getValue();
+    if (FnGrowthLimit.getNumOccurrences()) Opts.FnGrowthLimit = FnGrowthLimit.getValue();
+    for (const std::string &P : Placements) {
+        StringRef Pass, Where;
+        std::tie(Pass, Where) = StringRef(P).split('=');
+        PipelinePlacement *Slot = Pass == "str" ? &Opts.StrPlacement
+                                : Pass == "ind" ? &Opts.IndPlacement
+                                : Pass == "sub" ? &Opts.SubPlacement
+                                : Pass == "bcf" ? &Opts.BcfPlacement
+                                : Pass == "fla" ? &Opts.FlaPlacement
+                                                : nullptr;
+        if (!Slot || !parsePlacementName(Where, *Slot)) {
+            errs() << "Error: invalid -place value '" << P << "'.\n";
+            return 1;
+        }
+        if ((Slot == &Opts.StrPlacement || Slot == &Opts.IndPlacement) &&
+            *Slot != PipelinePlacement::PipelineStart && *Slot != PipelinePlacement::OptimizerLast) {
+            errs() << "Error: module pass '" << Pass << "' can only be placed at start or optimizer-last.\n";
+            return 1;
+        }
+    }
+    Opts.Seed = Seed ? Seed.getValue() : Utils::randomSeed();
+    std::unique_ptr<ObfuscationPolicy> Policy;
+    if (!PolicyFile.empty()) {
+        Expected<std::unique_ptr<ObfuscationPolicy>> Loaded = ObfuscationPolicy::load(PolicyFile);
+        if (!Loaded) {
+            errs() << "Error loading policy: " << toString(Loaded.takeError()) << "\n";
+            return 1;
+        }
+        Policy = std::move(*Loaded);
+        Opts.Policy = Policy.get();
+    }
+    Opts.GenReport = GenReport.getValue();
+    Opts.Stats = &Stats;
+
+    std::string outName = OutputFilename.getNumOccurrences() == 0 ? (FileType == OFT_Object ? "out.o" : "out.bc") : std::string(OutputFilename);
+    if (OutputFilename.getNumOccurrences() == 0 && InputFilename == "-") outName = "-";
+
+    if (Variants > 1 && (!ConnectSocket.empty() || Autotune || !FunctionReportPath.empty() ||
+                         !OrderFile.empty() || !MachineReportPath.empty() || !JITReportPath.empty() || outName == "-")) {
+        errs() << "Error: -variants cannot be combined with -connect, -autotune, -report-functions, -report-mc, -report-jit, -order-file or stdout output.\n";
+        return 1;
+    }
+
+    if (!ConnectSocket.empty() && (Policy || !MachineReportPath.empty() || !JITReportPath.empty() ||
+                                   !FunctionReportPath.empty() || LayoutHints || !OrderFile.empty() ||
+                                   Autotune || RunJIT)) {
+        errs() << "Error: -policy, -report-mc, -report-jit, -report-functions, -layout, -order-file, -autotune and "
+                  "-run-jit cannot be combined with -connect.\n";
+        return 1;
+    }
+
+    Phases.end("startup");
     std::string currentInput = InputFilename;
-    bool isSource = (currentInput.find(".c") != std::string::npos || currentInput.find(".cpp") != std::string::npos);
+    ErrorOr<std::unique_ptr<MemoryBuffer>> InputBuf = MemoryBuffer::getFileOrSTDIN(currentInput);
+    if (!InputBuf) {
+        errs() << "Error reading " << currentInput << ": " << InputBuf.getError().message() << "\n";
+        return 1;
+    }
+    Phases.end("read");
+
+     
+    StringRef InputData = (*InputBuf)->getBuffer();
+    bool isBitcodeInput = isBitcode(reinterpret_cast<const unsigned char *>(InputData.begin()),
+                                    reinterpret_cast<const unsigned char *>(InputData.end()));
+    bool isSource = currentInput != "-" && !isBitcodeInput && isSourceFile(currentInput);
     
     if (isSource) {
         std::string irFile = currentInput + ".ll";
@@ -64,73 +241,267 @@ int main(int argc, char **argv) {
             return 1;
         }
         currentInput = irFile;
+        InputBuf = MemoryBuffer::getFile(currentInput);
+        if (!InputBuf) {
+            errs() << "Error reading " << currentInput << ": " << InputBuf.getError().message() << "\n";
+            return 1;
+        }
+        Phases.end("compile");
+    }
+
+    if (!ConnectSocket.empty()) {
+        Expected<RemoteResult> Result = obfuscateRemote(ConnectSocket, (*InputBuf)->getBuffer(), Opts);
+        if (!Result) {
+            errs() << "Error: " << toString(Result.takeError()) << "\n";
+            return 1;
+        }
+        Phases.end("remote");
+
+        if (FileType == OFT_Object) {
+            LLVMContext Context;
+            SMDiagnostic Err;
+            std::unique_ptr<Module> M = parseIR(MemoryBufferRef(Result->Bitcode, currentInput), Err, Context);
+            if (!M) {
+                Err.print(argv[0], errs());
+                return 1;
+            }
+            ObjectEmitOptions EO;
+            EO.Partitions = CodegenSplit;
+            EO.Linker = RelocatableLinker;
+            if (Error E = emitObjectFile(*M, outName, EO)) {
+                errs() << "Error emitting object file: " << toString(std::move(E)) << "\n";
+                return 1;
+            }
+        } else {
+            std::error_code EC;
+            raw_fd_ostream OS(outName, EC, sys::fs::OF_None);
+            if (EC) {
+                errs() << "Error opening output file: " << EC.message() << "\n";
+                return 1;
+            }
+            if (outName == "-" && CheckBitcodeOutputToConsole(OS)) return 1;
+            OS << Result->Bitcode;
+        }
+
+        if (Opts.GenReport) {
+            std::error_code EC;
+            raw_fd_ostream ReportOS("obfuscation_report.json", EC, sys::fs::OF_Text);
+            if (EC) {
+                errs() << "Error opening report file: " << EC.message() << "\n";
+                return 1;
+            }
+            ReportOS << Result->Report;
+        }
+        Phases.end("write");
+        if (TimePhases) Phases.print(errs());
+        return 0;
     }
 
     LLVMContext Context;
     SMDiagnostic Err;
-    std::unique_ptr<Module> M = parseIRFile(currentInput, Err, Context);
+    std::unique_ptr<Module> M = parseIR((*InputBuf)->getMemBufferRef(), Err, Context);
 
     if (!M) {
         Err.print(argv[0], errs());
         return 1;
     }
+    Phases.end("parse");
 
-    ObfuscationStats Stats;
-    ObfuscationOptions Opts;
-    Opts.EnableFla = EnableFla.getValue();
-    Opts.EnableBcf = EnableBcf.getValue();
-    Opts.EnableSub = EnableSub.getValue();
-    Opts.EnableStr = EnableStr.getValue();
-    Opts.EnableInd = EnableInd.getValue();
-    Opts.FlaSplitNum = FlaSplit.getValue();
-    Opts.BcfProb = BcfProb.getValue();
-    Opts.Seed = Seed.getValue();
-    Opts.GenReport = GenReport.getValue();
-    Opts.Stats = &Stats;
+    if (RunJIT) {
+        // The JIT owns its context, so the module is parsed again into one.
+        auto JITContext = std::make_unique<LLVMContext>();
+        std::unique_ptr<Module> JITModule = parseIR((*InputBuf)->getMemBufferRef(), Err, *JITContext);
+        if (!JITModule) {
+            Err.print(argv[0], errs());
+            return 1;
+        }
+        ObfuscationTransform Transform(Opts);
+        std::vector<std::string> Args(JITArgs.begin(), JITArgs.end());
+        Expected<int> Status = runLazily(orc::ThreadSafeModule(std::move(JITModule), std::move(JITContext)),
+                                         Transform, Args, currentInput);
+        if (!Status) {
+            errs() << "Error running under the JIT: " << toString(Status.takeError()) << "\n";
+            return 1;
+        }
+        return *Status;
+    }
 
-    Utils::seedRandom(Opts.Seed);
+    if (Autotune) {
+        if (BenchCmd.empty() || Level == ObfuscationLevel::None) {
+            errs() << "Error: -autotune requires -bench-cmd and a -level other than none.\n";
+            return 1;
+        }
+        AutotuneOptions AO;
+        AO.BenchCommand = BenchCmd;
+        AO.Trials = TuneTrials;
+        AO.Runs = BenchRuns;
+        Expected<TuningResult> Result = autotune(*M, Opts, AO);
+        if (!Result) {
+            errs() << "Error: " << toString(Result.takeError()) << "\n";
+            return 1;
+        }
+        std::string presetName = PresetOut.empty() ? std::string("obfuscation_") + getLevelName(Level) + ".json" : std::string(PresetOut);
+        std::error_code EC;
+        raw_fd_ostream PresetOS(presetName, EC, sys::fs::OF_Text);
+        if (EC) {
+            errs() << "Error opening preset file: " << EC.message() << "\n";
+            return 1;
+        }
+        writePreset(PresetOS, Opts, *Result);
+        return 0;
+    }
 
-    LoopAnalysisManager LAM;
-    CGSCCAnalysisManager CGAM;
-    ModuleAnalysisManager MAM;
-    FunctionAnalysisManager FAM;
-    ModulePassManager MPM;
-    FunctionPassManager FPM;
-    
-    PassBuilder PB;
-    PB.registerLoopAnalyses(LAM);
-    PB.registerCGSCCAnalyses(CGAM);
-    PB.registerModuleAnalyses(MAM);
-    PB.registerFunctionAnalyses(FAM);
-    PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
-
-    if (Opts.EnableStr) MPM.addPass(StringEncryptionPass(Opts));
-    if (Opts.EnableInd) MPM.addPass(IndirectCallPass(Opts));
-    if (Opts.EnableSub) MPM.addPass(SubstitutionPass(Opts));
-    if (Opts.EnableBcf) MPM.addPass(BogusControlFlowPass(Opts));
-    if (Opts.EnableFla) MPM.addPass(FlatteningPass(Opts));
-
-    MPM.run(*M, MAM);
-
-    if (verifyModule(*M, &errs())) {
-        errs() << "Error: Module verification failed after obfuscation!\n";
-        return 1;
+    std::unique_ptr<FunctionLayout> Layout;
+    if (LayoutHints || !OrderFile.empty()) {
+        Layout = std::make_unique<FunctionLayout>(LayoutHints);
+        Opts.Layout = Layout.get();
     }
 
-    std::string outName = OutputFilename.getNumOccurrences() == 0 ? "out.bc" : std::string(OutputFilename);
-    
-    std::error_code EC;
-    raw_fd_ostream OS(outName, EC, sys::fs::OF_None);
-    if(EC) {
-        errs() << "Error opening output file: " << EC.message() << "\n";
+    if (Variants > 1) {
+        VariantOptions VO;
+        VO.Count = Variants;
+        VO.Threads = VariantThreads;
+        VO.OutputPattern = outName;
+        VO.EmitObject = FileType == OFT_Object;
+        VO.ObjectOptions.Partitions = CodegenSplit;
+        VO.ObjectOptions.Linker = RelocatableLinker;
+        VO.Verify = VerifyIR;
+        VO.VerifySample = VerifySample;
+        VO.VerifyModule = VerifyModule;
+        std::vector<VariantResult> Results = buildVariants(*M, Opts, VO);
+
+        int Failed = 0;
+        for (const VariantResult &R : Results) {
+            if (R.Error.empty()) continue;
+            errs() << "Error: variant " << R.Index << " (" << R.Path << "): " << R.Error << "\n";
+            Failed++;
+        }
+        if (Opts.GenReport) {
+            std::error_code EC;
+            raw_fd_ostream ReportOS("obfuscation_report.json", EC, sys::fs::OF_Text);
+            if (EC) {
+                errs() << "Error opening report file: " << EC.message() << "\n";
+                return 1;
+            }
+            writeVariantsReport(ReportOS, Results);
+        }
+        Phases.end("variants");
+        if (TimePhases) Phases.print(errs());
+        return Failed ? 1 : 0;
+    }
+
+    std::unique_ptr<ToolOutputFile> FnReportOut;
+    std::unique_ptr<FunctionReport> FnReport;
+    if (!FunctionReportPath.empty()) {
+        std::error_code EC;
+        FnReportOut = std::make_unique<ToolOutputFile>(FunctionReportPath, EC, sys::fs::OF_Text);
+        if (EC) {
+            errs() << "Error opening function report: " << EC.message() << "\n";
+            return 1;
+        }
+        FnReport = std::make_unique<FunctionReport>(FnReportOut->os());
+        Opts.FnReport = FnReport.get();
+    }
+
+    std::optional<MachineModuleStats> BaselineMC;
+    if (!MachineReportPath.empty()) {
+        std::unique_ptr<Module> Baseline;
+        if (Opts.OptLevel > 0) {
+            Baseline = CloneModule(*M);
+            ObfuscationOptions BaseOpts;
+            BaseOpts.OptLevel = Opts.OptLevel;
+            BaseOpts.Seed = Opts.Seed;
+            ObfuscationEngine(BaseOpts).run(*Baseline);
+        }
+        Expected<MachineModuleStats> Stats = collectMachineStats(Baseline ? *Baseline : *M);
+        if (!Stats) {
+            errs() << "Error lowering the baseline: " << toString(Stats.takeError()) << "\n";
+            return 1;
+        }
+        BaselineMC = std::move(*Stats);
+        Phases.end("report-mc");
+    }
+
+    if (!JITReportPath.empty()) {
+        Expected<JITLatencyReport> Latency = measureJITLatency(*M, Opts);
+        if (!Latency) {
+            errs() << "Error measuring JIT latency: " << toString(Latency.takeError()) << "\n";
+            return 1;
+        }
+        std::error_code EC;
+        raw_fd_ostream JITOS(JITReportPath, EC, sys::fs::OF_Text);
+        if (EC) {
+            errs() << "Error opening JIT report: " << EC.message() << "\n";
+            return 1;
+        }
+        writeJITLatencyReport(JITOS, *Latency);
+        Phases.end("report-jit");
+    }
+
+    FunctionVerifier Verifier(VerifyIR, VerifySample, VerifyThreads, VerifyModule);
+    Opts.Verifier = &Verifier;
+
+    ObfuscationEngine(Opts).run(*M);
+
+    if (Error E = Verifier.finish(*M)) {
+        errs() << "Error: verification failed after obfuscation:\n" << toString(std::move(E));
         return 1;
     }
-    WriteBitcodeToFile(*M, OS);
-    OS.close();
+    Phases.end("obfuscate");
+
+    if (BaselineMC) {
+        Expected<MachineModuleStats> Stats = collectMachineStats(*M);
+        if (!Stats) {
+            errs() << "Error lowering the obfuscated module: " << toString(Stats.takeError()) << "\n";
+            return 1;
+        }
+        std::error_code EC;
+        raw_fd_ostream MachineOS(MachineReportPath, EC, sys::fs::OF_Text);
+        if (EC) {
+            errs() << "Error opening machine report: " << EC.message() << "\n";
+            return 1;
+        }
+        writeMachineReport(MachineOS, *BaselineMC, *Stats);
+        Phases.end("report-mc");
+    }
+
+    if (FileType == OFT_Object) {
+        ObjectEmitOptions EO;
+        EO.Partitions = CodegenSplit;
+        EO.Linker = RelocatableLinker;
+        if (Error E = emitObjectFile(*M, outName, EO)) {
+            errs() << "Error emitting object file: " << toString(std::move(E)) << "\n";
+            return 1;
+        }
+    } else {
+        std::error_code EC;
+        raw_fd_ostream OS(outName, EC, sys::fs::OF_None);
+        if(EC) {
+            errs() << "Error opening output file: " << EC.message() << "\n";
+            return 1;
+        }
+        if (outName == "-" && CheckBitcodeOutputToConsole(OS)) return 1;
+        WriteBitcodeToFile(*M, OS);
+        OS.close();
+    }
 
     if (Opts.GenReport) {
-        generateReport("obfuscation_report.json", Stats);
+        if (!generateReport("obfuscation_report.json", Stats, Opts.Seed)) return 1;
+    }
+
+    if (!OrderFile.empty()) {
+        std::error_code EC;
+        raw_fd_ostream OrderOS(OrderFile, EC, sys::fs::OF_Text);
+        if (EC) {
+            errs() << "Error opening order file: " << EC.message() << "\n";
+            return 1;
+        }
+        Layout->writeOrderFile(OrderOS, *M);
     }
 
+    if (FnReportOut) FnReportOut->keep();
+    Phases.end("write");
+    if (TimePhases) Phases.print(errs());
+
     return 0;
 }
@@ -0,0 +1,179 @@
+#include "Obfuscation/Policy.h"
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/raw_ostream.h"
+#include <random>
+
+using namespace llvm;
+using namespace obfuscator;
+
+static int Failures = 0;
+
+#define CHECK(Cond)                                                                      \
+    do {                                                                                 \
+        if (!(Cond)) {                                                                   \
+            errs() << __FILE__ << ":" << __LINE__ << ": check failed: " #Cond "\n";      \
+            ++Failures;                                                                  \
+        }                                                                                \
+    } while (0)
+
+static std::unique_ptr<PatternAutomaton> compile(StringRef Pattern, bool Regex) {
+    auto A = std::make_unique<PatternAutomaton>();
+    Error E = Regex ? A->addRegex(Pattern, 0) : A->addGlob(Pattern, 0);
+    if (E) {
+        errs() << "cannot compile '" << Pattern << "': " << toString(std::move(E)) << "\n";
+        ++Failures;
+        return nullptr;
+    }
+    cantFail(A->compile());
+    return A;
+}
+
+static bool matches(const PatternAutomaton *A, StringRef Name) {
+    if (!A) return false;
+    SmallVector<unsigned, 4> Ids;
+    A->match(Name, Ids);
+    return !Ids.empty();
+}
+
+static bool regex(StringRef Pattern, StringRef Name) {
+    return matches(compile(Pattern, true).get(), Name);
+}
+
+static bool glob(StringRef Pattern, StringRef Name) {
+    return matches(compile(Pattern, false).get(), Name);
+}
+
+static void testAnchors() {
+    // Each anchor binds to its own top-level branch.
+    CHECK(regex("^ab|cd$", "abX"));
+    CHECK(regex("^ab|cd$", "Xcd"));
+    CHECK(!regex("^ab|cd$", "Xab"));
+    CHECK(!regex("^ab|cd$", "cdX"));
+    CHECK(regex("^ab$|x", "ab"));
+    CHECK(!regex("^ab$|x", "abc"));
+    CHECK(regex("^ab$|x", "zxz"));
+    CHECK(regex("^(ab|cd)$", "cd"));
+    CHECK(!regex("^(ab|cd)$", "acd"));
+}
+
+static void testClasses() {
+    CHECK(regex("^[^a-c]x$", "dx"));
+    CHECK(!regex("^[^a-c]x$", "bx"));
+    CHECK(glob("[!a]*", "bcd"));
+    CHECK(!glob("[!a]*", "abc"));
+    CHECK(glob("[]]x", "]x"));
+    CHECK(regex("^[\\]a]+$", "]a]"));
+    CHECK(regex("^[\\d_]+$", "12_3"));
+    CHECK(!regex("^[\\d_]+$", "12a"));
+    CHECK(regex("^\\W$", "-"));
+    CHECK(!regex("^\\W$", "w"));
+    CHECK(regex("^a\\.b$", "a.b"));
+    CHECK(!regex("^a\\.b$", "axb"));
+    CHECK(glob("a\\*", "a*"));
+    CHECK(!glob("a\\*", "ab"));
+}
+
+static void testRepetition() {
+    CHECK(regex("^ab?c$", "ac"));
+    CHECK(regex("^ab?c$", "abc"));
+    CHECK(!regex("^ab?c$", "abbc"));
+    CHECK(regex("^ab+c$", "abc"));
+    CHECK(regex("^ab+c$", "abbbc"));
+    CHECK(!regex("^ab+c$", "ac"));
+    CHECK(regex("^ab*c$", "ac"));
+    CHECK(regex("^ab*c$", "abbbc"));
+    CHECK(!regex("^ab*c$", "abd"));
+    CHECK(regex("^(ab)+$", "ababab"));
+    CHECK(!regex("^(ab)+$", "aba"));
+
+    PatternAutomaton A;
+    CHECK(errorToBool(A.addRegex("a{2}", 0)));
+    CHECK(errorToBool(A.addRegex("*a", 0)));
+}
+
+// Globs match the whole name; regexes match anywhere unless anchored.
+static void testWholeName() {
+    CHECK(glob("foo", "foo"));
+    CHECK(!glob("foo", "foobar"));
+    CHECK(!glob("foo", "xfoo"));
+    CHECK(glob("foo*", "foobar"));
+    CHECK(glob("?oo", "foo"));
+    CHECK(!glob("?oo", "fooo"));
+    CHECK(regex("foo", "xfoobar"));
+    CHECK(!regex("^foo$", "foobar"));
+}
+
+static void testMultiplePatterns() {
+    PatternAutomaton A;
+    cantFail(A.addGlob("f*", 2));
+    cantFail(A.addRegex("oo", 0));
+    cantFail(A.addGlob("bar", 1));
+    cantFail(A.compile());
+    SmallVector<unsigned, 4> Ids;
+    A.match("foo", Ids);
+    CHECK(Ids.size() == 2 && Ids[0] == 0 && Ids[1] == 2);
+    Ids.clear();
+    A.match("bar", Ids);
+    CHECK(Ids.size() == 1 && Ids[0] == 1);
+}
+
+static void testModuleFilter() {
+    auto P = ObfuscationPolicy::parse(R"({"rules": [
+        {"name": "other", "match": "f*", "module": "*/other.c", "bcf": false},
+        {"name": "all", "match": "f*", "bcf": true},
+        {"name": "late", "match": "foo", "fla": true}
+    ]})", false);
+    if (!P) {
+        errs() << "cannot parse policy: " << toString(P.takeError()) << "\n";
+        ++Failures;
+        return;
+    }
+
+    LLVMContext Ctx;
+    FunctionType *FT = FunctionType::get(Type::getVoidTy(Ctx), false);
+    Module Main("main", Ctx), Other("other", Ctx);
+    Main.setSourceFileName("src/main.c");
+    Other.setSourceFileName("src/other.c");
+    Function *F1 = Function::Create(FT, GlobalValue::ExternalLinkage, "foo", Main);
+    Function *F2 = Function::Create(FT, GlobalValue::ExternalLinkage, "foo", Other);
+    Function *F3 = Function::Create(FT, GlobalValue::ExternalLinkage, "decrypt_x", Other);
+
+    const PolicyRule *R = (*P)->lookup(*F1);
+    CHECK(R && R->Name == "all");
+    R = (*P)->lookup(*F2);
+    CHECK(R && R->Name == "other");
+    R = (*P)->lookup(*F3);
+    CHECK(R && R->Name == "decrypt_helper");
+}
+
+// Enough distinct DFA states to go past MaxCachedStates: after reading a
+// name of a/b the state records which of the last 17 characters were 'a'.
+static void testCacheReset() {
+    std::unique_ptr<PatternAutomaton> A = compile("a................$", true);
+    std::mt19937 Rng(1);
+    std::string Name;
+    for (int i = 0; i < 150000; ++i) Name += (Rng() & 1) ? 'a' : 'b';
+    for (size_t Len : {Name.size(), Name.size() - 1, size_t(17), size_t(16)}) {
+        StringRef Prefix = StringRef(Name).take_front(Len);
+        bool Expected = Len >= 17 && Prefix[Len - 17] == 'a';
+        CHECK(matches(A.get(), Prefix) == Expected);
+    }
+}
+
+int main() {
+    testAnchors();
+    testClasses();
+    testRepetition();
+    testWholeName();
+    testMultiplePatterns();
+    testModuleFilter();
+    testCacheReset();
+    if (Failures) {
+        errs() << Failures << " check(s) failed\n";
+        return 1;
+    }
+    outs() << "all policy checks passed\n";
+    return 0;
+}